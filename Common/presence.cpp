@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "presence.hpp"
+
+#include <algorithm>
+
+namespace {
+enum : char {
+    ARRAY = 0,
+    BITMAP = 1,
+};
+
+const int BITS_SIZE = Presence::CHUNK / 8;
+
+void put16(QByteArray& out, quint16 value)
+{
+    out.append(static_cast<char>(value >> 8));
+    out.append(static_cast<char>(value & 0xff));
+}
+
+quint16 get16(const unsigned char *cp)
+{
+    return static_cast<quint16>((cp[0] << 8) | cp[1]);
+}
+} // namespace
+
+Presence::Presence(int first, int last) :
+rangeFirst(first), rangeLast(last), members(0), validBitmap(false), validEncoding(false)
+{
+}
+
+void Presence::reset(int first, int last)
+{
+    chunks.clear();
+    rangeFirst = first;
+    rangeLast = last;
+    members = 0;
+    invalidate();
+}
+
+void Presence::invalidate()
+{
+    validBitmap = validEncoding = false;
+}
+
+bool Presence::offset(int number, quint16& key, quint16& low) const
+{
+    if(number < rangeFirst || number > rangeLast)
+        return false;
+
+    auto pos = static_cast<unsigned>(number - rangeFirst);
+    key = static_cast<quint16>(pos / CHUNK);
+    low = static_cast<quint16>(pos % CHUNK);
+    return true;
+}
+
+bool Presence::contains(int number) const
+{
+    quint16 key, low;
+    if(!offset(number, key, low))
+        return false;
+
+    auto chunk = chunks.constFind(key);
+    if(chunk == chunks.constEnd())
+        return false;
+    if(!chunk->bits.isEmpty())
+        return (chunk->bits[low / 8] & (1 << (low % 8))) != 0;
+    return std::binary_search(chunk->sparse.constBegin(), chunk->sparse.constEnd(), low);
+}
+
+bool Presence::insert(int number)
+{
+    quint16 key, low;
+    if(!offset(number, key, low))
+        return false;
+
+    auto& chunk = chunks[key];
+    if(chunk.sparse.isEmpty() && chunk.bits.isEmpty())
+        chunk.count = 0;
+
+    if(!chunk.bits.isEmpty()) {
+        auto mask = static_cast<char>(1 << (low % 8));
+        if(chunk.bits[low / 8] & mask)
+            return false;
+        chunk.bits[low / 8] = chunk.bits[low / 8] | mask;
+    }
+    else {
+        auto pos = std::lower_bound(chunk.sparse.begin(), chunk.sparse.end(), low);
+        if(pos != chunk.sparse.end() && *pos == low)
+            return false;
+        chunk.sparse.insert(pos, low);
+
+        // an array fuller than a bitmap becomes a bitmap...
+        if(static_cast<unsigned>(chunk.sparse.count()) > SPARSE) {
+            chunk.bits = QByteArray(BITS_SIZE, 0);
+            foreach(auto member, chunk.sparse)
+                chunk.bits[member / 8] = chunk.bits[member / 8] | static_cast<char>(1 << (member % 8));
+            chunk.sparse.clear();
+        }
+    }
+
+    ++chunk.count;
+    ++members;
+    invalidate();
+    return true;
+}
+
+bool Presence::remove(int number)
+{
+    quint16 key, low;
+    if(!offset(number, key, low) || !chunks.contains(key))
+        return false;
+
+    auto& chunk = chunks[key];
+    if(!chunk.bits.isEmpty()) {
+        auto mask = static_cast<char>(1 << (low % 8));
+        if(!(chunk.bits[low / 8] & mask))
+            return false;
+        chunk.bits[low / 8] = chunk.bits[low / 8] & ~mask;
+
+        // drop back to an array well below the threshold, to avoid thrashing
+        if(chunk.count - 1 <= SPARSE / 2) {
+            for(unsigned member = 0; member < CHUNK; ++member) {
+                if(chunk.bits[member / 8] & (1 << (member % 8)))
+                    chunk.sparse << static_cast<quint16>(member);
+            }
+            chunk.bits.clear();
+        }
+    }
+    else {
+        auto pos = std::lower_bound(chunk.sparse.begin(), chunk.sparse.end(), low);
+        if(pos == chunk.sparse.end() || *pos != low)
+            return false;
+        chunk.sparse.erase(pos);
+    }
+
+    if(--chunk.count == 0)
+        chunks.remove(key);
+    --members;
+    invalidate();
+    return true;
+}
+
+const UString& Presence::bitmap() const
+{
+    if(validBitmap)
+        return cachedBitmap;
+
+    QByteArray result;
+    if(isDense()) {
+        result = QByteArray(((rangeLast - rangeFirst) / 8) + 1, 0);
+        auto set = [&result](unsigned pos) {
+            result[pos / 8] = result[pos / 8] | static_cast<char>(1 << (pos % 8));
+        };
+
+        for(auto chunk = chunks.constBegin(); chunk != chunks.constEnd(); ++chunk) {
+            auto base = static_cast<unsigned>(chunk.key()) * CHUNK;
+            const auto& bits = chunk->bits;
+            if(bits.isEmpty()) {
+                foreach(auto member, chunk->sparse)
+                    set(base + member);
+                continue;
+            }
+            for(unsigned member = 0; member < CHUNK; ++member) {
+                if(bits[member / 8] & (1 << (member % 8)))
+                    set(base + member);
+            }
+        }
+    }
+
+    cachedBitmap = result.toBase64();
+    validBitmap = true;
+    return cachedBitmap;
+}
+
+const UString& Presence::encoded() const
+{
+    if(validEncoding)
+        return cachedEncoding;
+
+    QByteArray result;
+    for(auto chunk = chunks.constBegin(); chunk != chunks.constEnd(); ++chunk) {
+        put16(result, chunk.key());
+        if(chunk->bits.isEmpty()) {
+            result.append(ARRAY);
+            put16(result, static_cast<quint16>(chunk->count));
+            foreach(auto member, chunk->sparse)
+                put16(result, member);
+        }
+        else {
+            result.append(BITMAP);
+            put16(result, static_cast<quint16>(chunk->count));
+            result.append(chunk->bits);
+        }
+    }
+
+    cachedEncoding = result.toBase64();
+    validEncoding = true;
+    return cachedEncoding;
+}
+
+QByteArray Presence::decode(const QByteArray& encoded, int first, int last)
+{
+    if(last < first)
+        return QByteArray();
+
+    auto span = static_cast<unsigned>(last - first) + 1;
+    QByteArray result(static_cast<int>((span - 1) / 8) + 1, 0);
+    auto set = [&result, span](unsigned pos) {
+        if(pos < span)
+            result[pos / 8] = result[pos / 8] | static_cast<char>(1 << (pos % 8));
+    };
+
+    auto data = QByteArray::fromBase64(encoded);
+    auto cp = reinterpret_cast<const unsigned char *>(data.constData());
+    auto remains = data.size();
+    while(remains > 0) {
+        if(remains < 5)
+            return QByteArray();
+
+        auto base = static_cast<unsigned>(get16(cp)) * CHUNK;
+        auto type = static_cast<char>(cp[2]);
+        auto count = get16(cp + 3);
+        cp += 5;
+        remains -= 5;
+
+        if(type == ARRAY) {
+            if(remains < count * 2)
+                return QByteArray();
+            for(unsigned member = 0; member < count; ++member)
+                set(base + get16(cp + member * 2));
+            cp += count * 2;
+            remains -= count * 2;
+        }
+        else if(type == BITMAP) {
+            if(remains < BITS_SIZE)
+                return QByteArray();
+            for(unsigned member = 0; member < CHUNK; ++member) {
+                if(cp[member / 8] & (1 << (member % 8)))
+                    set(base + member);
+            }
+            cp += BITS_SIZE;
+            remains -= BITS_SIZE;
+        }
+        else
+            return QByteArray();
+    }
+    return result;
+}
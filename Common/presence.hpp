@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PRESENCE_HPP_
+#define PRESENCE_HPP_
+
+#include "../Common/types.hpp"
+#include <QMap>
+#include <QVector>
+
+class Presence final
+{
+public:
+    enum : unsigned {
+        CHUNK = 4096,                   // numbers per container
+        SPARSE = 256,                   // array until this many members
+        DENSE_LIMIT = 1000,             // largest range sent as plain bitmap
+    };
+
+    explicit Presence(int first = 0, int last = -1);
+
+    inline int first() const {
+        return rangeFirst;
+    }
+
+    inline int last() const {
+        return rangeLast;
+    }
+
+    inline unsigned count() const {
+        return members;
+    }
+
+    inline bool isDense() const {
+        return rangeLast >= rangeFirst && static_cast<unsigned>(rangeLast - rangeFirst) < DENSE_LIMIT;
+    }
+
+    void reset(int first, int last);
+    bool insert(int number);
+    bool remove(int number);
+    bool contains(int number) const;
+
+    const UString& bitmap() const;
+    const UString& encoded() const;
+
+    static QByteArray decode(const QByteArray& encoded, int first, int last);
+
+private:
+    using Container = struct {
+        QVector<quint16> sparse;        // sorted members of a sparse chunk
+        QByteArray bits;                // bitmap of a dense chunk
+        unsigned count;
+    };
+
+    QMap<quint16, Container> chunks;
+    int rangeFirst, rangeLast;
+    unsigned members;
+    mutable UString cachedBitmap, cachedEncoding;
+    mutable bool validBitmap, validEncoding;
+
+    bool offset(int number, quint16& key, quint16& low) const;
+    void invalidate();
+};
+
+/*!
+ * Compressed presence of online extensions.
+ * \file presence.hpp
+ */
+
+/*!
+ * \class Presence
+ * \brief A set of online extension numbers.
+ * Extensions are kept relative to the first number of the dialing plan in
+ * containers of 4096 numbers, in the manner of roaring bitmaps.  A
+ * container holds a sorted array of its members until it becomes full
+ * enough that a bitmap is smaller, and empty containers are dropped, so
+ * that large dialing plans with few online extensions stay small.
+ *
+ * Both the compressed and, for small ranges, the plain bitmap encodings
+ * are cached, and only rebuilt after a change in membership.  The
+ * compressed encoding is a base64 sequence of containers, each of which
+ * is a 16 bit key, a type byte of 0 for an array or 1 for a bitmap, a 16
+ * bit member count, and either the 16 bit members or a 512 byte bitmap.
+ * All values are in network byte order.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Presence::bitmap()
+ * Plain bitmap of the range, as sent to older clients.
+ * \return base64 bitmap, or empty if the range is too large for one.
+ *
+ * \fn Presence::encoded()
+ * \return base64 compressed container encoding.
+ *
+ * \fn Presence::decode(const QByteArray& encoded, int first, int last)
+ * Expand a received compressed encoding into a plain bitmap.
+ * \param encoded Base64 container encoding.
+ * \param first Number of the first extension in the bitmap.
+ * \param last Number of the last extension in the bitmap.
+ * \return plain bitmap, empty if the encoding is invalid.
+ */
+
+#endif
@@ -34,7 +34,7 @@ bool exiting = false;
 }
 
 Connector::Connector(const QVariantHash& cred, const QSslCertificate& cert) :
-active(true), context(nullptr)
+active(true), pendingMore(false), context(nullptr)
 {
     serverId = cred["extension"].toString();
     serverHost = cred["host"].toString().toUtf8();
@@ -89,6 +89,42 @@ void Connector::add_authentication()
     eXosip_add_authentication_info(context, serverId, user, secret, algo, realm);
 }
 
+// once a server nonce is known, requests are authorized before they are
+// sent, rather than each being challenged first.  Called with the eXosip
+// context locked, which also guards the cached challenge.
+void Connector::send_request(osip_message_t *msg)
+{
+    if(!serverCreds["nonce"].toString().isEmpty()) {
+        serverCreds["nc"] = serverCreds["nc"].toUInt() + 1;
+        add_authorization(msg, serverCreds);
+    }
+    eXosip_message_send_request(context, msg);
+}
+
+// remember the last challenge, which eXosip answers with a count of 1
+void Connector::save_challenge(osip_message_t *response)
+{
+    osip_www_authenticate_t *auth = nullptr;
+    if(!response || osip_message_get_www_authenticate(response, 0, &auth) != 0 || !auth || !auth->nonce)
+        return;
+
+    char buf[8];
+    eXosip_generate_random(buf, sizeof(buf));
+
+    Locker lock(context);
+    serverCreds["nonce"] = UString(auth->nonce).unquote();
+    if(auth->realm)
+        serverCreds["realm"] = UString(auth->realm).unquote();
+    if(auth->algorithm)
+        serverCreds["algorithm"] = UString(auth->algorithm).unquote().toUpper();
+    UString qop;
+    if(auth->qop_options)
+        qop = UString(auth->qop_options).unquote().replace(' ', "");
+    serverCreds["qop"] = qop.split(',').contains("auth") ? "auth" : "";
+    serverCreds["cnonce"] = QByteArray(buf, sizeof(buf)).toHex().toLower();
+    serverCreds["nc"] = 1;
+}
+
 void Connector::requestDeauthorize(const UString& to)
 {
     osip_message_t *msg = nullptr;
@@ -100,7 +136,7 @@ void Connector::requestDeauthorize(const UString& to)
         return;
 
     osip_message_set_header(msg, "X-Label", serverLabel);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::removeDevice(const UString& label)
@@ -114,7 +150,7 @@ void Connector::removeDevice(const UString& label)
 
     osip_message_set_header(msg, "X-Label", serverLabel);
     osip_message_set_header(msg, "X-Remove", label);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::createAuthorize(const UString& to, const QByteArray& body)
@@ -132,7 +168,7 @@ void Connector::createAuthorize(const UString& to, const QByteArray& body)
         osip_message_set_body(msg, body.constData(), static_cast<size_t>(body.length()));
         osip_message_set_content_type(msg, "authorize/json");
     }
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::changeTopic(const UString& to, const UString& subject, const UString& body)
@@ -151,7 +187,7 @@ void Connector::changeTopic(const UString& to, const UString& subject, const USt
         osip_message_set_body(msg, body.constData(), static_cast<size_t>(body.length()));
         osip_message_set_content_type(msg, "text/plain");
     }
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::changeForwarding(const UString& to, Forwarding type, int target)
@@ -182,7 +218,7 @@ void Connector::changeForwarding(const UString& to, Forwarding type, int target)
 
     osip_message_set_header(msg, "X-Label", serverLabel);
     osip_message_set_header(msg, "X-Destination", destination);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::changeCoverage(const UString& to, int priority)
@@ -201,7 +237,7 @@ void Connector::changeCoverage(const UString& to, int priority)
 
     osip_message_set_header(msg, "X-Label", serverLabel);
     osip_message_set_header(msg, "X-Priority", coverage);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::changeMemebership(const UString& to, const UString& subject, const UString& list, const UString& admin, const UString& notify, const UString& reason)
@@ -220,7 +256,7 @@ void Connector::changeMemebership(const UString& to, const UString& subject, con
     osip_message_set_header(msg, "X-Group-Admin", admin);
     osip_message_set_header(msg, "X-Notify", notify);
     osip_message_set_header(msg, "X-Reason", reason.escape());
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::disconnectUser(const UString& to)
@@ -234,7 +270,7 @@ void Connector::disconnectUser(const UString& to)
         return;
 
     osip_message_set_header(msg, "X-Label", serverLabel);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::changeSuspend(const UString& to, bool suspend)
@@ -253,7 +289,7 @@ void Connector::changeSuspend(const UString& to, bool suspend)
 
     osip_message_set_header(msg, "X-Label", serverLabel);
     osip_message_set_header(msg, "X-Suspend", value);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::changeAdmin(const UString& to, bool enable)
@@ -272,7 +308,7 @@ void Connector::changeAdmin(const UString& to, bool enable)
 
     osip_message_set_header(msg, "X-Label", serverLabel);
     osip_message_set_header(msg, "X-System", value);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::sendProfile(const UString& to, const QByteArray& body)
@@ -290,7 +326,7 @@ void Connector::sendProfile(const UString& to, const QByteArray& body)
         osip_message_set_body(msg, body.constData(), static_cast<size_t>(body.length()));
         osip_message_set_content_type(msg, "profile/json");
     }
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 void Connector::requestRoster()
@@ -304,7 +340,9 @@ void Connector::requestRoster()
     if(!msg)
         return;
     osip_message_set_header(msg, "X-Label", serverLabel);
-    eXosip_message_send_request(context, msg);
+    if(!rosterVersion.isEmpty())
+        osip_message_set_header(msg, "X-Roster", rosterVersion);
+    send_request(msg);
 }
 
 void Connector::requestDeviceList()
@@ -318,7 +356,7 @@ void Connector::requestDeviceList()
     if(!msg)
         return;
     osip_message_set_header(msg, "X-Label", serverLabel);
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
 }
 
 bool Connector::sendText(const UString& to, const UString& body, const UString& subject)
@@ -341,7 +379,7 @@ bool Connector::sendText(const UString& to, const UString& body, const UString&
 
     osip_message_set_body(msg, body.constData(), static_cast<size_t>(body.length()));
     osip_message_set_content_type(msg, "text/plain");
-    eXosip_message_send_request(context, msg);
+    send_request(msg);
     return true;
 }
 
@@ -403,6 +441,8 @@ void Connector::run()
                 emit topicFailed();
             if(MSG_IS_MESSAGE(event->request))
                 emit messageResult(error, QDateTime(), 0);
+            if(error == SIP_UNAUTHORIZED)
+                save_challenge(event->response);
             if(error != SIP_UNAUTHORIZED) {
                 emit statusResult(error, "");
                 qDebug() << "*** FAILED" << error;
@@ -494,8 +534,20 @@ void Connector::run()
     context = nullptr;
 }
 
+// pending comes in pages, with a cursor for the last message in the page
 void Connector::processPending(eXosip_event_t *event)
 {
+    osip_header_t *cursor = nullptr, *more = nullptr;
+    osip_message_header_get_byname(event->response, "x-cursor", 0, &cursor);
+    osip_message_header_get_byname(event->response, "x-more", 0, &more);
+    {
+        Locker lock(context);
+        pendingCursor.clear();
+        if(cursor && cursor->hvalue)
+            pendingCursor = cursor->hvalue;
+        pendingMore = more && more->hvalue && UString(more->hvalue).toBool();
+    }
+
     osip_body_t *body = nullptr;
     osip_message_get_body(event->response, 0, &body);
     if(body && body->body && body->length > 0) {
@@ -531,8 +583,16 @@ void Connector::processProfile(eXosip_event_t *event)
     }
 }
 
+// a server that versions rosters sends only changes after the first one
 void Connector::processRoster(eXosip_event_t *event)
 {
+    osip_header_t *header = nullptr;
+    osip_message_header_get_byname(event->response, "x-roster", 0, &header);
+    if(header && header->hvalue) {
+        Locker lock(context);
+        rosterVersion = header->hvalue;
+    }
+
     osip_body_t *body = nullptr;
     osip_message_get_body(event->response, 0, &body);
     if(body && body->body && body->length > 0) {
@@ -553,10 +613,13 @@ void Connector::requestPending()
     if(!msg)
         return;
     osip_message_set_header(msg, "X-Label", serverLabel);
-    eXosip_message_send_request(context, msg);
+    if(pendingMore && !pendingCursor.isEmpty())
+        osip_message_set_header(msg, "X-Cursor", pendingCursor);
+    send_request(msg);
 }
 
-void Connector::ackPending()
+// acknowledges the last page, and is true if there are more pages
+bool Connector::ackPending()
 {
     qDebug() << "ACK PENDING PROCESSED";
     auto to = UString::uri(serverSchema, serverHost, serverPort);
@@ -566,9 +629,12 @@ void Connector::ackPending()
     Locker lock(context);
     eXosip_message_build_request(context, &msg, A_PENDING, to, from, to);
     if(!msg)
-        return;
+        return false;
     osip_message_set_header(msg, "X-Label", serverLabel);
-    eXosip_message_send_request(context, msg);
+    if(!pendingCursor.isEmpty())
+        osip_message_set_header(msg, "X-Cursor", pendingCursor);
+    send_request(msg);
+    return pendingMore;
 }
 
 void Connector::stop(bool flag)
@@ -47,7 +47,7 @@ public:
     }
 
     void stop(bool shutdown = false);
-    void ackPending();
+    bool ackPending();
     void requestRoster();
     void requestPending();
     void requestDeviceList();
@@ -74,12 +74,17 @@ private:
     UString serverSchema;
     UString serverLabel;
     UString serverDisplay;
+    UString rosterVersion;          // of the last roster received
+    UString pendingCursor;          // last message of pending page
+    bool pendingMore;
     quint16 serverPort;
 
     eXosip_t *context;
     int family, tls;
 
     void add_authentication();
+    void send_request(osip_message_t *msg);
+    void save_challenge(osip_message_t *response);
     void processRoster(eXosip_event_t *event);
     void processProfile(eXosip_event_t *event);
     void processPending(eXosip_event_t *event);
@@ -121,7 +126,9 @@ private slots:
  * The Connector operates in it's own detached thread that receives eXosip
  * events and emits server responses as signals.  A context lock is used
  * to support calling methods that invoke server operations from the ui thread
- * context.
+ * context.  After the first roster, rosters are requested as changes since
+ * the version the server last sent.  Pending messages arrive in pages, and
+ * each page is acknowledged up to it's cursor before the next is requested.
  * \author David Sugar <tychosoft@gmail.com>
  */
 
@@ -16,6 +16,7 @@
  */
 
 #include "listener.hpp"
+#include "../Common/presence.hpp"
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -35,7 +36,7 @@ unsigned rosterSequence = 0xffff;
 } // namespace
 
 Listener::Listener(const QVariantHash& cred, const QSslCertificate& cert) :
-active(true), connected(false), registered(false), authenticated(false), context(nullptr)
+active(true), connected(false), registered(false), authenticated(false), presenceSequence(0), resyncing(false), context(nullptr)
 {
     serverId = cred["extension"].toString();
     serverHost = cred["host"].toString().toUtf8();
@@ -371,6 +372,16 @@ void Listener::receiveMessage(eXosip_event_t *event)
         goto error;
     }
 
+    // presence is only accepted from the server itself
+    if(UString(type->type) == "text" && type->subtype && UString(type->subtype) == "presence") {
+        if(!from || !from->url || !from->url->username || !isLocal(from->url) || UString(from->url->username) != "system") {
+            status = SIP_FORBIDDEN;
+            goto error;
+        }
+        receivePresence(UString(QByteArray(body->body, static_cast<int>(body->length))));
+        goto error;
+    }
+
     if(!to || !to->url || !to->url->username) {
         status = SIP_ADDRESS_INCOMPLETE;
         goto error;
@@ -465,6 +476,60 @@ error:
     eXosip_message_send_answer(context, event->tid, status, nullptr);
 }
 
+// deltas carry absolute states, so only a gap in sequence needs a resync
+void Listener::receivePresence(const UString& delta)
+{
+    quint32 sequence = 0;
+    QList<QByteArray> on, off;
+    foreach(auto line, delta.split('\n')) {
+        if(line.left(2) == "q=")
+            sequence = line.mid(2).toUInt();
+        else if(line.left(2) == "n=")
+            on = line.mid(2).split(',');
+        else if(line.left(2) == "x=")
+            off = line.mid(2).split(',');
+    }
+
+    if(!sequence || resyncing || priorOnline.isEmpty() || sequence <= presenceSequence)
+        return;
+
+    if(sequence != presenceSequence + 1) {
+        qDebug() << "Presence gap" << presenceSequence << "to" << sequence;
+        resyncPresence();
+        return;
+    }
+
+    presenceSequence = sequence;
+    auto apply = [this](const QList<QByteArray>& list, bool online) {
+        foreach(auto number, list) {
+            auto pos = number.toInt() - serverFirst;
+            if(pos < 0 || pos / 8 >= priorOnline.size())
+                continue;
+            auto mask = static_cast<char>(1 << (pos % 8));
+            if(online)
+                priorOnline[pos / 8] = priorOnline[pos / 8] | mask;
+            else
+                priorOnline[pos / 8] = priorOnline[pos / 8] & ~mask;
+        }
+    };
+
+    apply(on, true);
+    apply(off, false);
+    emit changeStatus(priorOnline, serverFirst, serverLast);
+}
+
+void Listener::resyncPresence()
+{
+    osip_message_t *msg = nullptr;
+    Locker lock(context);
+    resyncing = true;
+    eXosip_register_build_register(context, rid, AGENT_EXPIRES, &msg);
+    if(msg)
+        send_registration(msg);
+    else
+        resyncing = false;
+}
+
 bool Listener::isLocal(osip_uri_t *uri)
 {
     quint16 basePort = 5060;
@@ -521,6 +586,10 @@ QVariantHash Listener::parseXdp(const UString& xdp)
         }
         else if(line.left(2) == "l=")
             serverLast = line.mid(2).toInt();
+        else if(line.left(2) == "q=") {
+            presenceSequence = line.mid(2).toUInt();
+            resyncing = false;
+        }
         else if(line.left(2) == "a=") {
             QByteArray online = QByteArray::fromBase64(line.mid(2));
             if(online != priorOnline) {
@@ -528,6 +597,14 @@ QVariantHash Listener::parseXdp(const UString& xdp)
                 priorOnline = online;
             }
         }
+        else if(line.left(2) == "o=") {
+            // compressed presence of larger plans, after f= and l=
+            QByteArray online = Presence::decode(line.mid(2), serverFirst, serverLast);
+            if(online.count() && online != priorOnline) {
+                result["a"] = online;
+                priorOnline = online;
+            }
+        }
     }
     return result;
 }
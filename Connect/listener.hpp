@@ -47,10 +47,14 @@ private:
     void add_authentication();
     bool isLocal(osip_uri_t *uri);
     void receiveMessage(eXosip_event_t *event);
+    void receivePresence(const UString& delta);
+    void resyncPresence();
     QVariantHash parseXdp(const UString& text);
 
     QByteArray priorBanner;
     QByteArray priorOnline;
+    quint32 presenceSequence;
+    bool resyncing;
 
     QVariantHash serverCreds;
     UString uriFrom, uriRoute, sipLocal, sipFrom;
@@ -103,7 +107,10 @@ private slots:
  * to manage call sessions, and for realtime server status notifications.
  *
  * The Listener operates in it's own detached thread that receives eXosip
- * events and emits processed requests as signals.  A context lock is used
+ * events and emits processed requests as signals.  Presence is received as
+ * a full bitmap on registration, and then kept current from numbered deltas
+ * the server pushes as they happen.  A missing delta forces a registration
+ * refresh to resync the full bitmap.  A context lock is used
  * to support calling methods that invoke server operations from the ui thread
  * context.
  * \author David Sugar <tychosoft@gmail.com>
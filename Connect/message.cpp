@@ -68,18 +68,30 @@ void Message::add_authorization(osip_message_t *msg, const QVariantHash& creds,
     UString method = msg->sip_method;
     UString ha1 = QCryptographicHash::hash(user + ":" + realm + ":" + secret, digest).toHex().toLower();
     UString ha2 = QCryptographicHash::hash(method + ":" + uri, digest).toHex().toLower();
-    UString response = QCryptographicHash::hash(ha1 + ":" + nonce + ":" + ha2, digest).toHex().toLower();
+    UString response, count, cnonce;
+    if(creds["qop"].toString() == "auth") {
+        count = UString::number(creds["nc"].toUInt(), 16).rightJustified(8, '0');
+        cnonce = creds["cnonce"].toString();
+        response = QCryptographicHash::hash(ha1 + ":" + nonce + ":" + count + ":" + cnonce + ":auth:" + ha2, digest).toHex().toLower();
+    }
+    else
+        response = QCryptographicHash::hash(ha1 + ":" + nonce + ":" + ha2, digest).toHex().toLower();
+
     UString auth = "Digest username=\"" + user +
         "\", realm=\"" + realm +
         "\", uri=\"" + uri +
         "\", response=\"" + response +
         "\", nonce=\"" + nonce +
         "\", algorithm=\"" + algo + "\"";
+    if(!count.isEmpty())
+        auth += ", qop=auth, nc=" + count + ", cnonce=\"" + cnonce + "\"";
+    osip_free(uri);
 
+    // as a parsed header, so exosip may replace it if challenged again
     if(authenticate)
         osip_message_set_header(msg, WWW_AUTHENTICATE, auth);
     else
-        osip_message_set_header(msg, AUTHORIZATION, auth);
+        osip_message_set_authorization(msg, auth);
 }
 
 void Message::dump(osip_message_t *msg)
@@ -21,6 +21,7 @@
 #include "../Server/manager.hpp"
 #include "../Server/main.hpp"
 #include "authorize.hpp"
+#include "directory.hpp"
 #include <QSqlError>
 
 Authorize *Authorize::Instance = nullptr;
@@ -42,6 +43,8 @@ db(nullptr), failed(false)
     connect(database, &Database::updateAuthorize, this, &Authorize::activate);
     connect(this, &Authorize::copyOutboxes, database, &Database::copyOutbox);
     connect(this, &Authorize::syncOutbox, database, &Database::syncOutbox);
+    connect(this, &Authorize::updateExtension, database, &Database::refreshExtension);
+    connect(this, &Authorize::updateAccount, database, &Database::refreshAccount);
 
     // future connections for quick aync between manager and auth
     Manager *manager = Manager::instance();
@@ -54,6 +57,8 @@ db(nullptr), failed(false)
 Authorize::~Authorize()
 {
     if(local.isValid() && local.isOpen()) {
+        report();
+        statements.clear();
         local.close();
         local = QSqlDatabase();
         QSqlDatabase::removeDatabase("auth");
@@ -96,10 +101,11 @@ void Authorize::findEndpoint(const Event& event)
         return;
     }
 
-    auto endpoint = getRecord("SELECT * FROM Endpoints WHERE (extnbr=?) AND (label=?)", {number, label});
-    auto extension = getRecord("SELECT * FROM Extensions WHERE extnbr=?", {number});
+    auto directory = Directory::current();
+    auto eid = directory->endpoint(number, label);
+    auto extension = directory->extension(number);
 
-    if(extension.count() < 1) {
+    if(!extension) {
         warning() << "Cannot authorize " << number << "; not found";
         Context::reply(event, SIP_NOT_FOUND);
         return;
@@ -107,41 +113,49 @@ void Authorize::findEndpoint(const Event& event)
 
     // a sipwitch client specific registration feature...
     if(event.initialize() == "label") {
-        if(endpoint.count() < 1) {
+        if(eid < 0) {
+            // a repeated register may arrive before the directory refresh
+            // of the first, and then finds the row already created...
             warning() << "Initializing database for " << number << " with label " << label;
-            runQuery("INSERT INTO Endpoints(extnbr, label) VALUES (?,?);", {number, label});
-            endpoint = getRecord("SELECT * FROM Endpoints WHERE (extnbr=?) AND (label=?)", {number, label});
-            auto origin = getRecord("SELECT * FROM Endpoints WHERE (extnbr=?) AND (label='NONE')", {number});
-            emit copyOutboxes(origin.value("endpoint").toLongLong(), endpoint.value("endpoint").toLongLong());
+            auto created = runQuery("INSERT INTO Endpoints(extnbr, label) VALUES (?,?);", {number, label});
+            auto record = getRecord("SELECT * FROM Endpoints WHERE (extnbr=?) AND (label=?)", {number, label});
+            if(record.count() < 1) {
+                error() << "Cannot initialize " << number << " with label " << label;
+                Context::reply(event, SIP_INTERNAL_SERVER_ERROR);
+                return;
+            }
+            eid = record.value("endpoint").toLongLong();
+            if(created) {
+                emit copyOutboxes(directory->endpoint(number, "NONE"), eid);
+                emit updateExtension(number);
+            }
         }
         else {
             warning() << "Syncing database for " << number << " with label " << label;
-            emit syncOutbox(endpoint.value("endpoint").toLongLong());
+            emit syncOutbox(eid);
         }
     }
-    else  if(endpoint.count() < 1) {
+    else  if(eid < 0) {
         warning() << "Cannot authorize " << number << "; invalid label " << label;
         Context::reply(event, SIP_FORBIDDEN);
         return;
     }
 
-    auto eid = endpoint.value("endpoint").toLongLong();
-    auto user = extension.value("authname").toString();
-    auto authorize = getRecord("SELECT * FROM Authorize WHERE authname=?", {user});
-    if(authorize.count() < 1) {
+    auto user = extension->name;
+    auto authorize = directory->account(user);
+    if(!authorize) {
         error() << "Extension " << number << " has no authorization";
         Context::reply(event, SIP_FORBIDDEN);
         return;
     }
 
-    auto access = authorize.value("authaccess");
-    if(access == "SUSPEND") {
+    if(authorize->access == "SUSPEND") {
         warning() << "Extension " << number << " has been suspended";
         Context::reply(event, SIP_FORBIDDEN);
         return;
     }
 
-    auto type = authorize.value("authtype").toString();
+    auto type = authorize->type;
     if(type != "USER" && type != "DEVICE") {
         warning() << "Cannot authorize " << number << " as a " << type.toLower();
         Context::reply(event, SIP_FORBIDDEN);
@@ -163,28 +177,24 @@ void Authorize::findEndpoint(const Event& event)
     if(roffset > 0)
         request = request.mid(++roffset);
 
-    auto display = extension.value("display").toString();
+    auto display = extension->display;
     if(display.isEmpty())
-        display = authorize.value("fullname").toString();
+        display = authorize->fullname;
     if(display.isEmpty())
         display = user;
 
     auto privs = QString("none");
-    auto record = getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {number});
-    if(record.count() > 0)
+    if(directory->isAdmin(number))
         privs = "sysadmin";
-    else {
-        record = getRecord("SELECT * FROM Groups WHERE (grpnbr=0) AND (extnbr=?);", {number});
-        if(record.count() > 0)
-            privs = "operator";
-    }
+    else if(directory->isOperator(number))
+        privs = "operator";
 
     QVariantHash reply = {
-        {"realm", authorize.value("realm")},
+        {"realm", authorize->realm},
         {"user", user},
         {"display", display},
-        {"digest", authorize.value("authdigest")},
-        {"secret", authorize.value("secret")},
+        {"digest", authorize->digest},
+        {"secret", authorize->secret},
         {"number", number},
         {"label", label},
         {"endpoint", eid},
@@ -199,6 +209,8 @@ void Authorize::activate(const QVariantHash& config, bool opened)
 {
     Q_UNUSED(config);
     if(local.isValid() && local.isOpen()) {
+        report();
+        statements.clear();
         local.close();
         local = QSqlDatabase();
         QSqlDatabase::removeDatabase("auth");
@@ -242,11 +254,19 @@ void Authorize::activate(const QVariantHash& config, bool opened)
         thread()->setPriority(QThread::NormalPriority);
 }
 
+void Authorize::report()
+{
+    auto stats = statements.stats();
+    if(stats.hits + stats.misses)
+        debug() << "Authorize: statement hits=" << stats.hits << ", misses=" << stats.misses << ", cached=" << stats.size << ", rate=" << (stats.hits * 100) / (stats.hits + stats.misses) << "%";
+}
+
 bool Authorize::resume()
 {
     if(failed || &local != db)
         return false;
 
+    statements.clear();
     local.close();
     return checkConnection();
 }
@@ -258,6 +278,7 @@ bool Authorize::checkConnection()
             return true;
 
         qDebug() << "Authorize(RE-CONNECT)";
+        statements.clear();
         local.close();
         if(!local.open()) {
             failed = true;
@@ -280,8 +301,7 @@ bool Authorize::runQuery(const QString &request, const QVariantList &parms)
         return false;
 
     for(unsigned retries = 0; retries < 3; ++ retries) {
-        QSqlQuery query(local);
-        query.prepare(request);
+        auto query = statements.prepare(local, request);
 
         int count = -1;
             qDebug() << "Query" << request << "LIST" << parms;
@@ -295,6 +315,7 @@ bool Authorize::runQuery(const QString &request, const QVariantList &parms)
                 continue;
             break;
         }
+        query.finish();
         return true;
     }
     return false;
@@ -309,8 +330,7 @@ QSqlQuery Authorize::getRecords(const QString& request, const QVariantList& parm
         return QSqlQuery();
 
     for(unsigned retries = 0; retries < 3; ++retries) {
-        QSqlQuery query(local);
-        query.prepare(request);
+        auto query = statements.prepare(local, request);
         int count = -1;
         qDebug() << "Query " << request << " LIST " << parms;
         while(++count < parms.count())
@@ -337,8 +357,7 @@ QSqlRecord Authorize::getRecord(const QString& request, const QVariantList &parm
         return QSqlRecord();
 
     for(unsigned retries = 0; retries < 3; ++retries) {
-        QSqlQuery query(local);
-        query.prepare(request);
+        auto query = statements.prepare(local, request);
         int count = -1;
         qDebug() << "Request " << request << " LIST " << parms;
         while(++count < parms.count())
@@ -352,10 +371,11 @@ QSqlRecord Authorize::getRecord(const QString& request, const QVariantList &parm
             break;
         }
 
-        if(!query.next())
-            return QSqlRecord();
-
-        return query.record();
+        QSqlRecord record;
+        if(query.next())
+            record = query.record();
+        query.finish();
+        return record;
     }
     return QSqlRecord();
 }
@@ -389,6 +409,7 @@ void Authorize::removeAuthorization(const Event& ev)
 
     auto created = authinfo.value("created").toDateTime();
     runQuery("DELETE FROM Authorize WHERE (authname=?);", {auth});
+    emit updateAccount(auth);
 
     auto query = getRecords("SELECT * FROM Endpoints WHERE label != 'NONE';");
     while(query.isActive() && query.next()) {
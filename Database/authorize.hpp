@@ -40,6 +40,7 @@ protected:
 
     bool checkConnection();
     bool resume();
+    void report();
     bool runQuery(const QString& string, const QVariantList &parms = QVariantList());
     QSqlRecord getRecord(const QString& request, const QVariantList &parms = QVariantList());
     QSqlQuery getRecords(const QString& request, const QVariantList &parms = QVariantList());
@@ -48,6 +49,7 @@ private:
     Database *database;
     QSqlDatabase *db;
     QSqlDatabase local;
+    Statements statements;              // of the local connection
     bool failed;
 
     static Authorize *Instance;
@@ -56,6 +58,8 @@ signals:
     void createEndpoint(const Event& event, const QVariantHash& endpoint);
     void copyOutboxes(qlonglong source, qlonglong target);
     void syncOutbox(qlonglong endpoint);
+    void updateExtension(int number);
+    void updateAccount(const QString& name);
 
 protected slots:
     virtual void activate(const QVariantHash& config, bool isOpen);
@@ -81,6 +85,8 @@ private slots:
  * also allows separation of authorization handling, so ldap or other means can be
  * added in as well.  This base class will hold the signal-slot handling for
  * authorization requests, and slots will be implemented as protectd virtuals.
+ * Endpoints are found from the in-memory directory rather than by query,
+ * and changes made here are signalled to the database to refresh it.
  */
 
 #endif
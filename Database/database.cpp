@@ -22,6 +22,8 @@
 #include "../Server/main.hpp"
 #include "sqldriver.hpp"
 #include "database.hpp"
+#include "directory.hpp"
+#include "reader.hpp"
 
 #include <QDate>
 #include <QTime>
@@ -34,10 +36,18 @@
 
 #include <osipparser2/osip_headers.h>
 
+#define WRITE_WINDOW 10     // msecs to gather writes...
+#define WRITE_BATCH 64      // writes or rows per commit or insert...
+#define READERS 2           // default reader connections...
+#define RETAIN_BATCH 500    // messages removed per retention pass...
+#define RETAIN_WAIT 250     // msecs between passes when behind...
+#define RETAIN_INTERVAL 60000
+
 namespace {
 enum {
     // database events...
     COUNT_EXTENSIONS = QEvent::User + 1,
+    QUERY_REQUEST,
 };
 
 class DatabaseEvent final : public QEvent
@@ -60,11 +70,38 @@ private:
 DatabaseEvent::~DatabaseEvent() = default;
 
 bool failed = false;
+
+Directory::Account account(const QSqlRecord& record)
+{
+    return {
+        record.value("authname").toString(),
+        record.value("authtype").toString(),
+        record.value("authdigest").toString(),
+        record.value("realm").toString(),
+        record.value("secret").toString(),
+        record.value("authaccess").toString(),
+        record.value("email").toString(),
+        record.value("fullname").toString(),
+        record.value("created").toDateTime(),
+    };
+}
+
+Directory::Extension extension(const QSqlRecord& record)
+{
+    return {
+        record.value("extnbr").toInt(),
+        record.value("extpriority").toInt(),
+        record.value("authname").toString(),
+        record.value("display").toString(),
+        record.value("pubkey").toByteArray(),
+    };
+}
 } // namespace
 
 Database *Database::Instance = nullptr;
 
-Database::Database(unsigned order)
+Database::Database(unsigned order) :
+writeStats({0, 0, 0, 0}), expiredRequests(0), scheduler(nullptr), lastMid(0), nextReader(0)
 {
     firstNumber = lastNumber = -1;
     operatorPolicy = "system";
@@ -77,39 +114,124 @@ Database::Database(unsigned order)
 
     moveToThread(Server::createThread("database", order));
     dbTimer.moveToThread(thread());
-    dbTimer.setSingleShot(true);
+    dbTimer.setSingleShot(false);
+    writeTimer.moveToThread(thread());
+    writeTimer.setSingleShot(true);
+    writeTimer.setInterval(WRITE_WINDOW);
+    retainTimer.moveToThread(thread());
+    retainTimer.setSingleShot(true);
 
     Server *server = Server::instance();
     connect(thread(), &QThread::finished, this, &QObject::deleteLater);
     connect(server, &Server::changeConfig, this, &Database::applyConfig);
-    connect(server, &Server::dailyEvent, this, &Database::cleanupMessages);
     connect(&dbTimer, &QTimer::timeout, this, &Database::onTimeout);
+    connect(&retainTimer, &QTimer::timeout, this, &Database::cleanupMessages);
+    connect(&writeTimer, &QTimer::timeout, this, &Database::flush);
+
+    qRegisterMetaType<Request *>("Request *");
 
     Manager *manager = Manager::instance();
-    connect(manager, &Manager::sendRoster, this, &Database::sendRoster);
-    connect(manager, &Manager::changeProfile, this, &Database::sendProfile);
-    connect(manager, &Manager::removeDevice, this, &Database::removeDevice);
-    connect(manager, &Manager::sendDevlist, this, &Database::sendDeviceList);
-    connect(manager, &Manager::sendPending, this, &Database::sendPending);
-    connect(manager, &Manager::changePending, this, &Database::changePending);
-    connect(manager, &Manager::changeAuthorize, this, &Database::changeAuthorize);
-    connect(manager, &Manager::changeMembership, this, &Database::changeMembership);
-    connect(manager, &Manager::changeAdmin, this, &Database::changeAdmin);
-    connect(manager, &Manager::dropExtension, this, &Database::dropExtension);
-    connect(manager, &Manager::changeForwarding, this, &Database::changeForwarding);
-    connect(manager, &Manager::changeCoverage, this, &Database::changeCoverage);
-    connect(manager, &Manager::changeTopic, this, &Database::changeTopic);
-    connect(manager, &Manager::lastAccess, this, &Database::lastAccess);
-    connect(this, &Database::sendMessage, manager, &Manager::sendMessage);
+    scheduler = new Scheduler(thread(), "database");
+    scheduler->route(manager, &Manager::sendRoster, this, &Database::sendRoster, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::changeProfile, this, &Database::sendProfile, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::removeDevice, this, &Database::removeDevice, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::sendDevlist, this, &Database::sendDeviceList, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::sendPending, this, &Database::sendPending, Scheduler::MESSAGING);
+    scheduler->route(manager, &Manager::changePending, this, &Database::changePending, Scheduler::MESSAGING);
+    scheduler->route(manager, &Manager::changeAuthorize, this, &Database::changeAuthorize, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::changeMembership, this, &Database::changeMembership, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::changeAdmin, this, &Database::changeAdmin, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::dropExtension, this, &Database::dropExtension, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::changeForwarding, this, &Database::changeForwarding, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::changeCoverage, this, &Database::changeCoverage, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::changeTopic, this, &Database::changeTopic, Scheduler::CONTROL);
+    scheduler->route(manager, &Manager::lastAccess, this, &Database::lastAccess, Scheduler::REGISTRATION);
+    manager->queues()->route(this, &Database::sendMessage, manager, &Manager::sendMessage, Scheduler::MESSAGING);
     connect(this, &Database::disconnectEndpoint, manager, &Manager::dropEndpoint);
 }
 
 Database::~Database()
 {
     Instance = nullptr;
+    flush();
     close();
 }
 
+void Database::write(const QString& request, const QVariantList& parms)
+{
+    writes << Write{request, QString(), parms, 0};
+    if(writes.count() >= WRITE_BATCH)
+        flush();
+    else if(!writeTimer.isActive())
+        writeTimer.start();
+}
+
+// rows for the same table are coalesced into one insert
+void Database::write(const QString& prefix, const QString& row, const QVariantList& parms)
+{
+    if(!writes.isEmpty() && writes.last().prefix == prefix && writes.last().rows < WRITE_BATCH) {
+        auto& last = writes.last();
+        last.request += "," + row;
+        last.parms += parms;
+        ++last.rows;
+        return;
+    }
+    writes << Write{prefix + row, prefix, parms, 1};
+    if(writes.count() >= WRITE_BATCH)
+        flush();
+    else if(!writeTimer.isActive())
+        writeTimer.start();
+}
+
+void Database::afterCommit(const std::function<void(bool)>& notify)
+{
+    commits << notify;
+    if(!writeTimer.isActive())
+        writeTimer.start();
+}
+
+void Database::flush()
+{
+    writeTimer.stop();
+    if(writes.isEmpty() && commits.isEmpty())
+        return;
+
+    QList<Write> list;
+    QList<std::function<void(bool)>> notify;
+    list.swap(writes);
+    notify.swap(commits);
+
+    QElapsedTimer timer;
+    timer.start();
+    auto ok = reopen();
+    if(ok && !list.isEmpty()) {
+        auto transaction = db.transaction();
+        foreach(const auto& op, list) {
+            if(!runQuery(op.request, op.parms)) {
+                ok = false;
+                break;
+            }
+        }
+        if(transaction && ok)
+            ok = db.commit();
+        else if(transaction)
+            db.rollback();
+    }
+
+    auto nsecs = timer.nsecsElapsed();
+    ++writeStats.batches;
+    writeStats.writes += static_cast<quint64>(list.count());
+    writeStats.nsecs += nsecs;
+    if(nsecs > writeStats.highest)
+        writeStats.highest = nsecs;
+
+    if(!ok)
+        error() << "Database commit of " << list.count() << " writes failed";
+
+    foreach(auto& done, notify)
+        done(ok);
+}
+
 int Database::runQueries(const QStringList& list)
 {
     int count = 0;
@@ -128,12 +250,14 @@ int Database::runQueries(const QStringList& list)
 
 bool Database::runQuery(const QString &request, const QVariantList &parms)
 {
+    if(!writes.isEmpty())
+        flush();
+
     if(!reopen())
         return false;
 
     for(unsigned retries = 0; retries < 3; ++retries) {
-        QSqlQuery query(db);
-        query.prepare(request);
+        auto query = statements.prepare(db, request);
 
         int count = -1;
             qDebug() << "Query" << request << "LIST" << parms;
@@ -147,6 +271,7 @@ bool Database::runQuery(const QString &request, const QVariantList &parms)
                 continue;
             break;
         }
+        query.finish();
         return true;
     }
     return false;
@@ -154,12 +279,14 @@ bool Database::runQuery(const QString &request, const QVariantList &parms)
 
 QVariant Database::insert(const QString& request, const QVariantList &parms)
 {
+    if(!writes.isEmpty())
+        flush();
+
     if(!reopen())
         return QVariant();
 
     for(unsigned retries = 0; retries < 3; ++retries) {
-        QSqlQuery query(db);
-        query.prepare(request);
+        auto query = statements.prepare(db, request);
         int count = -1;
         qDebug() << "Request " << request << " LIST " << parms;
         while(++count < parms.count())
@@ -172,19 +299,23 @@ QVariant Database::insert(const QString& request, const QVariantList &parms)
                 continue;
             break;
         }
-        return query.lastInsertId();
+        auto id = query.lastInsertId();
+        query.finish();
+        return id;
     }
     return QVariant();
 }
 
 QSqlRecord Database::getRecord(const QString& request, const QVariantList &parms)
 {
+    if(!writes.isEmpty())
+        flush();
+
     if(!reopen())
         return QSqlRecord();
 
     for(unsigned retries = 0; retries < 3; ++retries) {
-        QSqlQuery query(db);
-        query.prepare(request);
+        auto query = statements.prepare(db, request);
         int count = -1;
         qDebug() << "Request " << request << " LIST " << parms;
         while(++count < parms.count())
@@ -198,22 +329,25 @@ QSqlRecord Database::getRecord(const QString& request, const QVariantList &parms
             break;
         }
 
-        if(!query.next())
-            return QSqlRecord();
-
-        return query.record();
+        QSqlRecord record;
+        if(query.next())
+            record = query.record();
+        query.finish();
+        return record;
     }
     return QSqlRecord();
 }
 
 QSqlQuery Database::getRecords(const QString& request, const QVariantList &parms)
 {
+    if(!writes.isEmpty())
+        flush();
+
     if(!reopen())
         return QSqlQuery();
 
     for(unsigned retries = 0; retries < 3; ++retries) {
-        QSqlQuery query(db);
-        query.prepare(request);
+        auto query = statements.prepare(db, request);
         int count = -1;
         qDebug() << "Query " << request << " LIST " << parms;
         while(++count < parms.count())
@@ -235,6 +369,24 @@ void Database::init(unsigned order)
 {
     Q_ASSERT(Instance == nullptr);
     Instance = new Database(order);
+
+    auto count = Server::config("database/readers").toInt();
+    if(count < 1)
+        count = READERS;
+    else if(count > 16)
+        count = 16;
+
+    for(auto id = 1; id <= count; ++id)
+        Instance->readers << new Reader(order, id);
+}
+
+// writes are committed first so that the reader will see them
+Reader *Database::reader()
+{
+    flush();
+    auto next = readers[nextReader];
+    nextReader = (nextReader + 1) % readers.count();
+    return next;
 }
 
 bool Database::resume()
@@ -253,6 +405,8 @@ bool Database::resume()
 void Database::close()
 {
     dbTimer.stop();
+    onTimeout();
+    statements.clear();
     if(db.isOpen()) {
         db.close();
         debug() << "Database(CLOSE)";
@@ -269,11 +423,8 @@ bool Database::reopen()
     if(failed)
         return false;
 
-    if(db.isOpen()) {
-        dbTimer.setInterval(interval);
-        dbTimer.setSingleShot(true);
+    if(db.isOpen())
         return true;
-    }
 
     close();
     db = QSqlDatabase::addDatabase(dbDriver, "default");
@@ -361,10 +512,24 @@ bool Database::create()
     if(dbConfig.count() < 1)
         crit(80) << "Uninitialized database for " << dbDriver << "; use ipl loader";
 
-    if(dbConfig.value("dialplan").toString() == "STD3") {
+    // standard plans reserve leading 7, 8, 9, and 0 for dialing out...
+    auto dialplan = dbConfig.value("dialplan").toString();
+    if(dialplan == "STD3") {
         firstNumber = 100;
         lastNumber = 699;
     }
+    else if(dialplan == "STD4") {
+        firstNumber = 1000;
+        lastNumber = 6999;
+    }
+    else if(dialplan == "STD5") {
+        firstNumber = 10000;
+        lastNumber = 69999;
+    }
+    else if(dialplan == "STD6") {
+        firstNumber = 100000;
+        lastNumber = 699999;
+    }
 
     qDebug() << "Extension range" << firstNumber << "to" << lastNumber;
 
@@ -372,16 +537,164 @@ bool Database::create()
         runQuery("INSERT INTO Switches(uuid, version) VALUES (?,?);", {dbUuid, PROJECT_VERSION});
 
     if(!init)
-        cleanupMessages();
+        upgrade();
+
+    // never re-use message ids an endpoint already has seen...
+    lastMid = getRecord("SELECT MAX(mid) AS last FROM Messages;").value("last").toLongLong();
+    auto marks = getRecord("SELECT MAX(delivered) AS delivered, MAX(sent) AS sent FROM Endpoints;");
+    lastMid = qMax(lastMid, qMax(marks.value("delivered").toLongLong(), marks.value("sent").toLongLong()));
 
+    cleanupMessages();
+    loadDirectory();
     return true;
 }
 
+// add delivery watermarks to databases created before them
+void Database::upgrade()
+{
+    if(!db.record("Endpoints").contains("delivered")) {
+        info() << "Adding delivery watermarks to endpoints";
+        runQuery("ALTER TABLE Endpoints ADD COLUMN delivered BIGINT DEFAULT 0;");
+        runQuery("ALTER TABLE Endpoints ADD COLUMN sent BIGINT DEFAULT 0;");
+    }
+    if(!db.record("Messages").contains("mailbox")) {
+        info() << "Adding mailboxes to messages";
+        runQuery("ALTER TABLE Messages ADD COLUMN mailbox INTEGER DEFAULT NULL;");
+        runQuery("ALTER TABLE Messages ADD COLUMN origin INTEGER DEFAULT NULL;");
+    }
+
+    // indexes for retention and pending, which mysql cannot add if missing
+    static const QList<QStringList> indexes = {
+        {"messagePosted", "Messages", "posted"},
+        {"messageMailbox", "Messages", "mailbox, mid"},
+        {"outboxMessage", "Outboxes", "mid"},
+    };
+
+    foreach(const auto& index, indexes) {
+        if(isFile()) {
+            runQuery(QString("CREATE INDEX IF NOT EXISTS %1 ON %2(%3);").arg(index[0], index[1], index[2]));
+            continue;
+        }
+
+        auto found = getRecord("SELECT COUNT(*) AS count FROM information_schema.statistics "
+                               "WHERE table_schema=DATABASE() AND table_name=? AND index_name=?;", {index[1], index[0]});
+        if(found.value("count").toInt() > 0)
+            continue;
+
+        info() << "Adding index " << index[0] << " to " << index[1];
+        runQuery(QString("CREATE INDEX %1 ON %2(%3);").arg(index[0], index[1], index[2]));
+    }
+}
+
+void Database::loadDirectory()
+{
+    std::shared_ptr<Directory> directory(new Directory());
+
+    auto query = getRecords("SELECT * FROM Authorize;");
+    while(query.isActive() && query.next())
+        directory->insert(account(query.record()));
+
+    query = getRecords("SELECT * FROM Extensions;");
+    while(query.isActive() && query.next())
+        directory->insert(extension(query.record()));
+
+    query = getRecords("SELECT endpoint, extnbr, label FROM Endpoints ORDER BY endpoint;");
+    while(query.isActive() && query.next()) {
+        auto record = query.record();
+        directory->endpointMap[record.value("extnbr").toInt()] << Directory::Endpoint {
+            record.value("endpoint").toLongLong(),
+            record.value("label").toString(),
+        };
+    }
+
+    query = getRecords("SELECT grpnbr, extnbr FROM Groups;");
+    while(query.isActive() && query.next()) {
+        auto record = query.record();
+        directory->groupMap[record.value("grpnbr").toInt()] << record.value("extnbr").toInt();
+    }
+
+    query = getRecords("SELECT extnbr FROM Admin WHERE authname='system';");
+    while(query.isActive() && query.next())
+        directory->admins << query.record().value("extnbr").toInt();
+
+    Directory::publish(directory);
+    qDebug() << "Directory loaded" << directory->extensionMap.count();
+}
+
+// reload a changed extension into a new version of the directory
+void Database::refreshExtension(int number)
+{
+    std::shared_ptr<Directory> directory(new Directory(*Directory::current()));
+    directory->remove(number);
+
+    auto record = getRecord("SELECT * FROM Extensions WHERE extnbr=?;", {number});
+    if(record.count() > 0) {
+        auto ext = extension(record);
+        directory->insert(ext);
+
+        record = getRecord("SELECT * FROM Authorize WHERE authname=?;", {ext.name});
+        if(record.count() > 0)
+            directory->insert(account(record));
+
+        auto query = getRecords("SELECT endpoint, label FROM Endpoints WHERE extnbr=? ORDER BY endpoint;", {number});
+        while(query.isActive() && query.next()) {
+            record = query.record();
+            directory->endpointMap[number] << Directory::Endpoint {
+                record.value("endpoint").toLongLong(),
+                record.value("label").toString(),
+            };
+        }
+
+        query = getRecords("SELECT grpnbr, extnbr FROM Groups WHERE (grpnbr=?) OR (extnbr=?);", {number, number});
+        while(query.isActive() && query.next()) {
+            record = query.record();
+            directory->groupMap[record.value("grpnbr").toInt()] << record.value("extnbr").toInt();
+        }
+
+        if(getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {number}).count() > 0)
+            directory->admins << number;
+    }
+
+    Directory::publish(directory);
+}
+
+void Database::refreshAccount(const QString& name)
+{
+    std::shared_ptr<Directory> directory(new Directory(*Directory::current()));
+    auto record = getRecord("SELECT * FROM Authorize WHERE authname=?;", {name});
+    if(record.count() > 0)
+        directory->insert(account(record));
+    else
+        directory->remove(name);
+
+    Directory::publish(directory);
+}
+
+// retention is enforced a bounded range of message ids at a time, as ids
+// are assigned in the order messages are posted...
 void Database::cleanupMessages()
 {
     QDateTime expires = QDateTime::currentDateTime();
     expires = expires.addDays(-msgRetention);
-    runQuery("DELETE FROM Messages WHERE posted < ?", {expires});
+
+    auto bound = lastMid + 1;
+    auto record = getRecord("SELECT mid FROM Messages WHERE posted >= ? ORDER BY posted LIMIT 1;", {expires});
+    if(record.count() > 0)
+        bound = record.value("mid").toLongLong();
+
+    auto first = getRecord("SELECT MIN(mid) AS first FROM Messages WHERE posted < ?;", {expires}).value("first").toLongLong();
+    if(first < 1 || first >= bound) {
+        retainTimer.start(RETAIN_INTERVAL);
+        return;
+    }
+
+    // outboxes are removed with their messages, even without cascades...
+    auto upto = qMin(bound, first + RETAIN_BATCH);
+    qDebug() << "Expiring messages" << first << "to" << upto - 1;
+    write("DELETE FROM Outboxes WHERE mid IN "
+          "(SELECT mid FROM Messages WHERE mid < ? AND posted < ?);", {upto, expires});
+    write("DELETE FROM Messages WHERE mid < ? AND posted < ?;", {upto, expires});
+    retainTimer.start(upto < bound ? RETAIN_WAIT : RETAIN_INTERVAL);
 }
 
 int Database::getCount(const QString& id)
@@ -421,6 +734,9 @@ bool Database::event(QEvent *evt)
     switch(id) {
     case COUNT_EXTENSIONS:
         return true;
+    case QUERY_REQUEST:
+        query(reply);
+        return true;
     default:
         break;
     }
@@ -429,63 +745,35 @@ bool Database::event(QEvent *evt)
 
 void Database::copyOutbox(qlonglong source, qlonglong target)
 {
-    unsigned count = 0;
-    auto query = getRecords("SELECT * FROM Outboxes WHERE endpoint=?", {source});
-    while(query.isActive() && query.next()) {
-        auto record = query.record();
-        runQuery("INSERT INTO Outboxes(mid,endpoint,msgstatus) "
-                 "VALUES(?,?,0);", {record.value("mid"), target});
-        ++count;
-    }
-    qDebug() << "Copied" << count << "outboxes from" << source << "to" << target;
+    // a new device starts from where the unlabeled one is...
+    auto delivered = lastMid;
+    if(source > -1)
+        delivered = getRecord("SELECT delivered FROM Endpoints WHERE endpoint=?;", {source}).value("delivered").toLongLong();
+
+    write("UPDATE Endpoints SET delivered=?, sent=? WHERE endpoint=?;", {delivered, delivered, target});
+    write("INSERT INTO Outboxes(mid,endpoint,msgstatus) "
+          "SELECT mid, ?, 0 FROM Outboxes WHERE endpoint=?;", {target, source});
+    qDebug() << "Copying outboxes from" << source << "to" << target;
 }
 
 void Database::syncOutbox(qlonglong endpoint)
 {
     qDebug() << "Sync outbox" << endpoint;
-    runQuery("UPDATE Outboxes SET msgstatus = 0 WHERE endpoint=?;", {endpoint});
+    write("UPDATE Outboxes SET msgstatus = 0 WHERE endpoint=?;", {endpoint});
+    write("UPDATE Endpoints SET delivered=0, sent=0 WHERE endpoint=?;", {endpoint});
 }
 
 void Database::lastAccess(qlonglong endpoint, const QDateTime& timestamp, const QString& agent, const QByteArray& deviceKey, const QString &uri)
 {
     if(deviceKey.length() > 0)
-        runQuery("UPDATE Endpoints SET lastaccess=?,lasturi=?,devkey=?,agent=? WHERE endpoint=?;", {timestamp, uri, deviceKey, agent, endpoint});
+        write("UPDATE Endpoints SET lastaccess=?,lasturi=?,devkey=?,agent=? WHERE endpoint=?;", {timestamp, uri, deviceKey, agent, endpoint});
     else
-        runQuery("UPDATE Endpoints SET lastaccess=?,lasturi=?,agent=? WHERE endpoint=?;", {timestamp, uri, agent, endpoint});
+        write("UPDATE Endpoints SET lastaccess=?,lasturi=?,agent=? WHERE endpoint=?;", {timestamp, uri, agent, endpoint});
 }
 
 void Database::sendDeviceList(const Event& event)
 {
-    qDebug() << "Seeking device list";
-
-    auto query = getRecords("SELECT * FROM Endpoints WHERE extnbr=?;", {event.number()});
-
-    QJsonArray list;
-    while(query.isActive() && query.next()) {
-        qDebug() << "QUERY" << query.record();
-        auto record = query.record();
-        auto endpoint = record.value("endpoint").toString();
-        auto extension = record.value("extnbr").toString();
-        auto label = record.value("label").toString();
-        auto agent = record.value("agent").toString();
-        auto resgistrated = record.value("created").toString();
-        auto lastOnline = record.value("lastaccess").toString();
-        auto lastUri = record.value("lastUri").toString();
-
-        QJsonObject profile {
-            {"e", endpoint},
-            {"n", extension},
-            {"u", label},
-            {"a", agent},
-            {"l", lastUri},
-            {"r", resgistrated},
-            {"o", lastOnline},
-        };
-        list << profile;
-    }
-    QJsonDocument jdoc(list);
-    auto json = jdoc.toJson(QJsonDocument::Compact);
-    Context::answerWithJson(event, json);
+    read(event, Request::Devlist);
 }
 
 void Database::messageResponse(const QByteArray& mid, const QByteArray& ep, int status)
@@ -494,8 +782,29 @@ void Database::messageResponse(const QByteArray& mid, const QByteArray& ep, int
     qlonglong message = mid.toLongLong();
     qlonglong endpoint = ep.toLongLong();
 
-    runQuery("UPDATE Outboxes SET msgstatus=? WHERE mid=? AND endpoint=?;",
+    // rows of named targets, or earlier exceptions, are updated.  A failed
+    // mailbox message has no row, and stays pending above the mark...
+    write("UPDATE Outboxes SET msgstatus=? WHERE mid=? AND endpoint=?;",
         {status, message, endpoint});
+    if(status != SIP_OK) {
+        qDebug() << "MESSAGE RESPONSE" << message << endpoint << status;
+        return;
+    }
+
+    // a delivery with nothing else pending under it advances the mark...
+    write("UPDATE Endpoints SET delivered=? WHERE endpoint=? AND delivered < ? AND NOT EXISTS ("
+          "SELECT 1 FROM Messages WHERE Messages.mid > Endpoints.delivered AND Messages.mid < ? AND "
+          "Messages.mailbox IS NOT NULL AND " + mailboxes("Endpoints.extnbr") + " AND NOT EXISTS ("
+          "SELECT 1 FROM Outboxes WHERE Outboxes.mid=Messages.mid AND "
+          "Outboxes.endpoint=Endpoints.endpoint AND Outboxes.msgstatus=200));", {
+            message, endpoint, message, message,
+            (operatorPolicy == "public") ? 1 : 0,
+        });
+
+    // ...and only a delivery out of order is kept as a row
+    write("REPLACE INTO Outboxes(mid, endpoint, msgstatus) "
+          "SELECT ?, endpoint, ? FROM Endpoints WHERE endpoint=? AND delivered < ?;",
+        {message, status, endpoint, message});
 
     qDebug() << "MESSAGE RESPONSE" << message << endpoint << status;
 }
@@ -503,12 +812,8 @@ void Database::messageResponse(const QByteArray& mid, const QByteArray& ep, int
 bool Database::adminMessage(const Event& event, int to, const QString& msgText, int from, const QString& msgDisplay, int expires)
 {
     QList<qlonglong> sendList;
-    auto query = getRecords("SELECT endpoint FROM Endpoints WHERE extnbr=?;", {to});
-    while(query.isActive() && query.next()) {
-        auto record = query.record();
-        auto endpoint = record.value("endpoint").toLongLong();
-        sendList << endpoint;
-    }
+    foreach(const auto& ep, Directory::current()->endpoints(to))
+        sendList << ep.endpoint;
 
     // create datatypes for msg table insertion...
     auto msgFrom = QString::number(from);
@@ -524,23 +829,22 @@ bool Database::adminMessage(const Event& event, int to, const QString& msgText,
     else
         msgExpires = msgPosted.addDays(30);
 
-    auto mid = insert("INSERT INTO Messages(msgseq, msgfrom, msgto, subject, display, posted, msgtype, msgtext, expires) "
-                            "VALUES(?,?,?,?,?,?,?,?,?);", {
-                                msgSequence,
-                                msgFrom,
-                                msgTo,
-                                msgSubject,
-                                msgDisplay,
-                                msgPosted,
-                                msgType,
-                                msgText,
-                                msgExpires
-                            });
-
-    if(!mid.isValid()) {
-        qDebug() << "MESSAGE INSERT BAD";
-        return false;
-    }
+    auto mid = ++lastMid;
+    write("INSERT INTO Messages(mid, msgseq, msgfrom, msgto, subject, display, posted, msgtype, msgtext, expires, mailbox, origin) VALUES ",
+          "(?,?,?,?,?,?,?,?,?,?,?,?)", {
+              mid,
+              msgSequence,
+              msgFrom,
+              msgTo,
+              msgSubject,
+              msgDisplay,
+              msgPosted,
+              msgType,
+              msgText,
+              msgExpires,
+              to,
+              QVariant(QVariant::Int)
+          });
 
     QVariantHash data;          // to be sent to manager for each send/sync
     data["f"] = msgFrom.toUtf8();
@@ -552,15 +856,19 @@ bool Database::adminMessage(const Event& event, int to, const QString& msgText,
     data["p"] = msgPosted;
     data["u"] = msgSequence;
     data["e"] = expires;
-    data["r"] = mid.toString().toUtf8();
+    data["r"] = QByteArray::number(mid);
 
-    foreach(auto endpoint, sendList) {
-        auto outbox = insert("INSERT INTO Outboxes(mid, endpoint, msgstatus) "
-                             "VALUES(?,?,0);", {mid, endpoint});
-        qDebug() << "OUTBOX POSTED FOR" << endpoint;
-        emit sendMessage(endpoint, data);
-    }
+    // pending for the extension's endpoints by it's mailbox...
+    qDebug() << "MAILBOX POSTED FOR" << to;
 
+    afterCommit([this, sendList, data](bool ok) {
+        if(!ok) {
+            qDebug() << "MESSAGE INSERT BAD";
+            return;
+        }
+        foreach(auto endpoint, sendList)
+            emit sendMessage(endpoint, data);
+    });
     return true;
 }
 
@@ -579,15 +887,14 @@ void Database::localMessage(const Event& ev)
     UString to = msg->to->url->username;
     QSet<qlonglong> sendList;  // local endpoints to send to
     QList<int> targets;         // target extension #'s
+    auto directory = Directory::current();
 
     // if from local extenion, validate it has endpoints, find outbox sync
     if(number > 0) {
         auto count = 0;
-        auto query = getRecords("SELECT endpoint, label FROM Endpoints WHERE extnbr=?;", {number});
-        while(query.isActive() && query.next()) {
-            auto record = query.record();
-            auto label = record.value("label").toString().toUtf8();
-            auto endpoint = record.value("endpoint").toLongLong();
+        foreach(const auto& ep, directory->endpoints(number)) {
+            auto label = ep.label.toUtf8();
+            auto endpoint = ep.endpoint;
             ++count;
             // do not sync outbox to self...
             if(isLabeled && label == ev.label())
@@ -607,25 +914,19 @@ void Database::localMessage(const Event& ev)
 
     if(to.isNumber()) {
         // see if group...
-        auto count = 0;
-        auto query = getRecords("SELECT extnbr FROM Groups WHERE grpnbr=?;", {to.toInt()});
-        while(query.isActive() && query.next()) {
-            auto member = query.record().value("extnbr").toInt();
+        auto members = directory->members(to.toInt());
+        foreach(auto member, members) {
             // dont send to self in group...
             if(member != number)
                 targets << member;
-            ++count;
         }
-        if(!count)
+        if(members.isEmpty())
             targets << to.toInt();
     }
     else {
         // gather extensions by auth record for named public access
         QString name = QString::fromUtf8(to);
-        auto query = getRecords("SELECT extnbr FROM Extensions WHERE authname=?;", {name});
-        while(query.isActive() && query.next()) {
-            targets << query.record().value("extnbr").toInt();
-        }
+        targets << directory->extensions(name);
     }
 
     // if no targets, we definately go no further...but if qt client, we must
@@ -637,16 +938,14 @@ void Database::localMessage(const Event& ev)
 
     // if public lobby send to all labelled entities...
     if(targets.count() == 1 && targets[0] == 0 && operatorPolicy == "public") {
-        auto query = getRecords("SELECT endpoint FROM Endpoints WHERE label != 'NONE';");
-        while(query.isActive() && query.next())
-            sendList << query.record().value("endpoint").toLongLong();
+        foreach(auto endpoint, directory->labeled())
+            sendList << endpoint;
     }
     else {
         // otherwise convert targets to an endpoint send list...
         foreach(auto target, targets) {
-            auto query = getRecords("SELECT endpoint FROM Endpoints WHERE extnbr=?;", {target});
-            while(query.isActive() && query.next())
-                sendList << query.record().value("endpoint").toLongLong();
+            foreach(const auto& ep, directory->endpoints(target))
+                sendList << ep.endpoint;
         }
     }
 
@@ -681,109 +980,129 @@ void Database::localMessage(const Event& ev)
     if(number < 1)
         msgFrom = QString::fromUtf8(ev.from().toString());
 
-    auto mid = insert("INSERT INTO Messages(msgseq, msgfrom, msgto, subject, display, posted, msgtype, msgtext, expires) "
-                            "VALUES(?,?,?,?,?,?,?,?,?);", {
-                                msgSequence,
-                                msgFrom,
-                                msgTo,
-                                msgSubject,
-                                msgDisplay,
-                                msgPosted,
-                                msgType,
-                                msgText,
-                                msgExpires
-                            });
-
-    if(!mid.isValid()) {
-        qDebug() << "MESSAGE INSERT BAD";
-        if(!isLabeled)
-            Context::reply(ev, SIP_INTERNAL_SERVER_ERROR);
-        return;
-    }
-
-    // later reply for other devices...
-    qDebug() << "MESSAGE OK";
-    if(!isLabeled)
-        Context::reply(ev, SIP_OK);
-
-    if(sendList.count() == 0)
-        return;
+    // numbered targets are pending by mailbox, named ones by outbox...
+    QVariant mailbox(QVariant::Int), origin(QVariant::Int);
+    if(to.isNumber())
+        mailbox = to.toInt();
+    if(isLabeled)
+        origin = number;
+
+    auto mid = ++lastMid;
+    write("INSERT INTO Messages(mid, msgseq, msgfrom, msgto, subject, display, posted, msgtype, msgtext, expires, mailbox, origin) VALUES ",
+          "(?,?,?,?,?,?,?,?,?,?,?,?)", {
+              mid,
+              msgSequence,
+              msgFrom,
+              msgTo,
+              msgSubject,
+              msgDisplay,
+              msgPosted,
+              msgType,
+              msgText,
+              msgExpires,
+              mailbox,
+              origin
+          });
 
     QVariantHash data;          // to be sent to manager for each send/sync
     data["f"] = msgFrom.toUtf8();
     data["t"] = msgTo.toInt();
     data["d"] = ev.display();
     data["c"] = ev.contentType();
-    data["b"] = ev.body();
+    data["b"] = QByteArray(ev.body().constData(), ev.body().size());  // own copy
     data["s"] = ev.subject();
     data["p"] = ev.timestamp();
     data["u"] = ev.sequence();
     data["e"] = ev.expires();
-    data["r"] = mid.toString().toUtf8();
+    data["r"] = QByteArray::number(mid);
 
     // by tracking our messages sent we can also make sure to sync new
     // extensions or even recover old messages from the server.
+    QList<qlonglong> deliver;
     foreach(auto endpoint, sendList) {
         auto msgstatus = 0;
         if(endpoint == self || endpoint == none)
             msgstatus = SIP_OK;
-        auto outbox = insert("INSERT INTO Outboxes(mid, endpoint, msgstatus) "
-                             "VALUES(?,?,?);", {mid, endpoint, msgstatus});
-        qDebug() << "OUTBOX POSTED FOR" << endpoint;
-        if(msgstatus == SIP_OK)     // dont send if we marked them ok...
-            continue;
-        emit sendMessage(endpoint, data);
+        // a mailbox message only needs exceptions to it's mailbox...
+        if(mailbox.isNull() || msgstatus == SIP_OK) {
+            write("INSERT INTO Outboxes(mid, endpoint, msgstatus) VALUES ", "(?,?,?)", {mid, endpoint, msgstatus});
+            qDebug() << "OUTBOX POSTED FOR" << endpoint;
+        }
+        if(msgstatus != SIP_OK)     // dont send if we marked them ok...
+            deliver << endpoint;
     }
-}
 
-void Database::changePending(qlonglong endpoint)
-{
-    qDebug() << "Update pending for " << endpoint;
+    // reply and deliver once the message is committed
+    afterCommit([this, ev, isLabeled, deliver, data](bool ok) {
+        if(!ok) {
+            qDebug() << "MESSAGE INSERT BAD";
+            if(!isLabeled)
+                Context::reply(ev, SIP_INTERNAL_SERVER_ERROR);
+            return;
+        }
 
-    // clear status of any pending messages we already sent with prior
-    // last pending.
-    runQuery("UPDATE Outboxes SET msgstatus=200 WHERE msgstatus=100 AND endpoint=?;", {endpoint});
+        // later reply for other devices...
+        qDebug() << "MESSAGE OK";
+        if(!isLabeled)
+            Context::reply(ev, SIP_OK);
+
+        foreach(auto endpoint, deliver)
+            emit sendMessage(endpoint, data);
+    });
 }
 
-void Database::sendPending(const Event& event, qlonglong endpoint)
+// a client that pages thru pending acknowledges up to it's cursor
+void Database::changePending(const Event& event, qlonglong endpoint)
 {
-    qDebug() << "Seeking pending for " << event.number() << event.label();
+    auto last = cursor(event);
+    qDebug() << "Update pending for " << endpoint << "to" << last;
 
-    // given that we have requested pending we can clean any already sent
-    // roster deletions...
-    runQuery("DELETE FROM Deletes WHERE (delstatus=1) AND (endpoint=?);", {endpoint});
+    // advance the delivery mark, and clear status of any pending messages
+    // we already sent with prior last pending.
+    if(last > 0) {
+        write("UPDATE Endpoints SET delivered=? WHERE endpoint=? AND delivered < ?;", {last, endpoint, last});
+        write("UPDATE Outboxes SET msgstatus=200 WHERE msgstatus=100 AND endpoint=? AND mid <= ?;", {endpoint, last});
+    }
+    else {
+        write("UPDATE Endpoints SET delivered=sent WHERE endpoint=? AND delivered < sent;", {endpoint});
+        write("UPDATE Outboxes SET msgstatus=200 WHERE msgstatus=100 AND endpoint=?;", {endpoint});
+    }
 
-    // get list of pending (unsent) messages...
-    auto query = getRecords("SELECT * FROM Outboxes JOIN Messages ON Outboxes.mid = Messages.mid WHERE endpoint=? AND msgstatus != 200;", {endpoint});
+    // delivered rows under the mark are no longer exceptions...
+    write("DELETE FROM Outboxes WHERE endpoint=? AND msgstatus=200 AND mid <= "
+          "(SELECT delivered FROM Endpoints WHERE endpoint=?);", {endpoint, endpoint});
+}
 
-    QJsonArray list;
-    while(query.isActive() && query.next()) {
-        auto record = query.record();
-        QJsonObject message {
-            {"f", record.value("msgfrom").toString()},
-            {"t", record.value("msgto").toString()},
-            {"d", record.value("display").toString()},
-            {"b", record.value("msgtext").toString()},
-            {"c", record.value("msgtype").toString()},
-            {"s", record.value("subject").toString()},
-            {"p", record.value("posted").toDateTime().toString(Qt::ISODate)},
-            {"u", record.value("msgseq").toInt()},
-            {"e", record.value("expires").toDateTime().toString(Qt::ISODate)},
-        };
+void Database::sendPending(const Event& event, qlonglong endpoint)
+{
+    read(event, Request::Pending, endpoint);
+}
 
-        // qDebug() << "*** PENDING" << message << record.value("msgstatus").toInt();
-        list.insert(0, message);    // reverse order...
-    }
+// messages a reader sent in a page of pending
+void Database::markPending(qlonglong endpoint, qlonglong after, qlonglong last)
+{
+    write("UPDATE Endpoints SET sent=? WHERE endpoint=?;", {last, endpoint});
+    write("UPDATE Outboxes SET msgstatus=100 WHERE msgstatus != 200 AND endpoint=? AND mid > ? AND mid <= ?;", {endpoint, after, last});
+}
 
-    // mark what we sent in this batch as 100/in progress...
-    runQuery("UPDATE Outboxes SET msgstatus=100 WHERE msgstatus != 200 AND endpoint=?;", {endpoint});
+// messages pending for an extension thru it's mailboxes, with the
+// extension as a bound value or a column, followed by the public flag
+QString Database::mailboxes(const QString& extension)
+{
+    return QString(
+        "(Messages.origin=%1 OR Messages.mailbox=%1 OR "
+        "(Messages.mailbox IN (SELECT grpnbr FROM Groups WHERE Groups.extnbr=%1) AND "
+        "Messages.msgfrom != CAST(%1 AS CHAR)) OR "
+        "(Messages.mailbox=0 AND ?=1))").arg(extension);
+}
 
-    if(list.count() < 1)
-        Context::reply(event, SIP_OK);
-    else {
-        QJsonDocument jdoc(list);
-        Context::answerWithJson(event, jdoc.toJson(QJsonDocument::Compact));
-    }
+qlonglong Database::cursor(const Event& event)
+{
+    osip_header_t *header = nullptr;
+    osip_message_header_get_byname(event.sent(), "x-cursor", 0, &header);
+    if(!header || !header->hvalue)
+        return 0;
+    return UString(header->hvalue).toLongLong();
 }
 
 void Database::changeAuthorize(const Event& event)
@@ -849,6 +1168,7 @@ void Database::changeAuthorize(const Event& event)
                  "VALUES(?,?);", {target, user});
         if(!group)
             runQuery("INSERT INTO Endpoints(extnbr) VALUES(?);", {target});
+        refreshExtension(target);
         Manager::updateRoster();
     }
     Context::reply(event, SIP_OK);
@@ -1033,6 +1353,7 @@ void Database::changeCoverage(const Event& event, const UString& authUser, qlong
         if(priority > -1)
             runQuery("INSERT INTO Calling(authname,extnbr, extpriority) VALUES(?,?,?)", {coveringUser, number, priority});
     }
+    refreshExtension(number);
     sendProfile(event, authUser, endpoint);
 }
 
@@ -1118,6 +1439,7 @@ void Database::changeAdmin(const Event& event, const UString& authuser, qlonglon
             runQuery("UPDATE Authorize SET authaccess='LOCAL' WHERE authname=?;", {user});
     }
 
+    refreshExtension(target);
     sendProfile(event, authuser, endpoint);
     if(!disconnect)
         return;
@@ -1209,6 +1531,7 @@ void Database::changeMembership(const Event& event, const UString& authuser, qlo
     }
 
     // generate reply with changes, notify users effected...
+    refreshExtension(target);
     sendProfile(event, authuser, endpoint);
     osip_message_header_get_byname(msg, "x-reason", 0, &reason);
     if(!reason || !reason->hvalue)
@@ -1270,28 +1593,38 @@ void Database::removeDevice(const Event& event, const UString& authuser, qlonglo
     auto removeEndpoint = record.value("endpoint").toLongLong();
     emit disconnectEndpoint(removeEndpoint);
     runQuery("DELETE FROM Endpoints WHERE endpoint=?;", {removeEndpoint});
+    refreshExtension(number);
     sendProfile(event, authuser, endpoint);
 }
 
+// profile changes are made here, and the profile is then read back
 void Database::sendProfile(const Event& event, const UString& authuser, qlonglong endpoint)
 {
+    if(expired(event))
+        return;
+
     auto target = atoi(event.message()->to->url->username);
-    auto number = event.number();
     qDebug() << "Seeking profile for" << target;
     if(target != 0 && (target < firstNumber || target > lastNumber)) {
         Context::reply(event, SIP_FORBIDDEN);
         return;
     }
 
+    if(event.body().size() > 0 && !changeProfile(event, authuser, endpoint, target))
+        return;
+
+    read(event, Request::Profile, endpoint);
+}
+
+bool Database::changeProfile(const Event& event, const UString& authuser, qlonglong endpoint, int target)
+{
     auto record = getRecord("SELECT * FROM Extensions JOIN Authorize ON Extensions.authname = Authorize.authname WHERE Extensions.extnbr=?;", {target});
     if(record.count() < 1) {
         Context::reply(event, SIP_NOT_FOUND);
-        return;
+        return false;
     }
 
-    auto type = record.value("authtype").toString();
     auto access = record.value("authaccess").toString();
-    auto created = record.value("created").toDateTime().toString(Qt::ISODate);
     auto display = record.value("display").toString();
     auto altDisplay = record.value("fullname").toString();
     if(altDisplay.isEmpty())
@@ -1300,332 +1633,103 @@ void Database::sendProfile(const Event& event, const UString& authuser, qlonglon
         display = record.value("fullname").toString();
     if(display.isEmpty())
         display = record.value("authname").toString();
-    auto uri = event.uriTo(record.value("extnbr").toString());
     auto email = record.value("email").toString();
     auto userid = record.value("authname").toString();
     auto secret = record.value("secret").toString();
-    auto ringPriority = record.value("extpriority").toInt();
-    auto publicKey = record.value("pubkey").toByteArray();
-
-    auto fwdBusy = record.value("fwdbusy").toInt();
-    auto fwdNoAnswer = record.value("fwdnoanswer").toInt();
-    auto fwdAway = record.value("fwdaway").toInt();
-    auto coverage = -1, groupPriority = -1;
-
-    // what is my call priority in group xxx?
-    if(type == "GROUP" || type == "PILOT" || target == 0) {
-        auto calling = getRecord("SELECT extpriority FROM Groups WHERE (grpnbr=?) and (extnbr=?);", {target, number});
-        if(calling.count() > 0) {
-            if(target == 0)             // operators always do immediate coverage
-                groupPriority = 0;
-            else
-                groupPriority = calling.value("extpriority").toInt();
-        }
-    }
-    auto calling = getRecord("SELECT extpriority FROM Calling WHERE (authname=?) and (extnbr=?);", {userid, number});
-    if(calling.count() > 0)
-        coverage = calling.value("extpriority").toInt();
-
-    if(coverage > 3)
-        coverage = 3;
-    else if(coverage < 0)
-        coverage = -1;
-
-    if(groupPriority > 3)
-        groupPriority = 3;
-    else if(groupPriority < 0)
-        groupPriority = -1;
-
-    if(ringPriority > 3)
-        ringPriority = 3;
-    else if(ringPriority < 0)
-        ringPriority = -1;
-
-    QString info, puburi;
-    if(access == "REMOTE")
-        puburi = userid + "@" + QString::fromUtf8(Server::sym(CURRENT_NETWORK));
-
-    auto privs = QString("none");
-    if(access == "SUSPEND")
-        privs = "suspend";
-    else {
-        auto admin = getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {target});
-        if(admin.count() > 0)
-            privs = "sysadmin";
-        else {
-            auto oper = getRecord("SELECT * FROM Groups WHERE (grpnbr=0) AND (extnbr=?);", {target});
-            if(oper.count() > 0)
-                privs = "operator";
-        }
-    }
 
-    auto groupAccess = QString("none");
-    auto groupList = QString("");
-
-    if(type == "GROUP" || type == "PILOT" || target == 0) {
-        auto listAccess = false;
-        auto admin = getRecord("SELECT * FROM Admin WHERE (authname=?) AND (extnbr=?);", {userid, event.number()});
-        if(admin.count() > 0) {
-            listAccess = true;
-            groupAccess = "admin";
-        }
-        else {
-            auto member = getRecord("SELECT * FROM Groups WHERE (grpnbr=?) AND (extnbr=?);", {target, event.number()});
-            if(member.count() > 0) {
-                listAccess = true;
-                groupAccess = "member";
-                auto query = getRecords("SELECT * FROM Admin WHERE (authname=?);", {userid});
-                if(query.isActive() && query.next()) {
-                    auto groupAdmin = query.record();
-                    groupAccess = groupAdmin.value("extnbr").toString();
-                }
-            }
-        }
-        if(!listAccess) {
-            auto sysop = getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {event.number()});
-            if(sysop.count() > 0)
-                listAccess = true;
-        }
-        if(listAccess) {
-            auto query = getRecords("SELECT * FROM Groups WHERE (grpnbr=?);", {target});
-            const char *sep = "";
-            while(query.isActive() && query.next()) {
-                auto member = query.record();
-                groupList += sep + member.value("extnbr").toString();
-                sep = ",";
-            }
-        }
-    }
     // operators are special...
     if(target == 0)
         display = operatorDisplay;
 
-    QJsonObject profile {
-        {"a", userid},
-        {"c", created},
-        {"k", QString::fromUtf8(publicKey.toHex())},
-        {"n", target},
-        {"d", display},
-        {"g", groupAccess},
-        {"m", groupList},
-        {"u", QString::fromUtf8(uri)},
-        {"t", type},
-        {"e", email},
-        {"p", puburi},
-        {"i", info},
-        {"s", privs},
-        {"busy", fwdBusy},
-        {"noanswer", fwdNoAnswer},
-        {"away", fwdAway},
-        {"cc", coverage},
-        {"gp", groupPriority},
-        {"rp", ringPriority},
-    };
+    bool allowed = (userid == authuser);
+    bool operAllowed = false;
+    bool admin = false;
 
-    // self query
-    if(target == event.number()) {
-        auto speeds = getRecords("SELECT extnbr,target FROM Speeds WHERE (authname=?) AND (extnbr < 10);", {userid});
-        while(speeds.isActive() && speeds.next()) {
-            auto item = speeds.record();
-            auto speedDial = item.value("extnbr").toString();
-            if(speedDial < "1")
-                continue;
-            profile[speedDial] = item.value("target").toString();
-        }
-
-        // self device list...
-        QJsonArray devices;
-        auto query = getRecords("SELECT * FROM Endpoints WHERE (extnbr=?) AND (label != 'NONE') AND (label != ?) ORDER BY label;", {event.number(), event.label()});
-        while(query.isActive() && query.next()) {
-            auto devitem = query.record();
-            auto devendpoint = devitem.value("endpoint").toString();
-            auto label = devitem.value("label").toString();
-            auto agent = devitem.value("agent").toString();
-            auto resgistrated = devitem.value("created").toString();
-            auto lastOnline = devitem.value("lastaccess").toString();
-            auto lastUri = devitem.value("lasturi").toString();
-            auto deviceKey = devitem.value("devkey").toByteArray();
-
-            QJsonObject device {
-                {"e", devendpoint},
-                {"k", QString(deviceKey.toHex())},
-                {"u", label},
-                {"a", agent},
-                {"r", resgistrated},
-                {"l", lastUri},
-                {"o", lastOnline},
-            };
-            devices << device;
-        }
-        profile["ep"] = devices;
+    record = getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {event.number()});
+    if(record.count() > 0) {
+        admin = true;
+        allowed = true;
+        operAllowed = true;
     }
 
-    if(event.body().size() > 0) {
-        bool allowed = (userid == authuser);
-        bool operAllowed = false;
-        bool admin = false;
-
-        record = getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {event.number()});
-        if(record.count() > 0) {
-            admin = true;
-            allowed = true;
+    if(!operAllowed) {
+        record = getRecord("SELECT * FROM Groups WHERE (grpnbr=0) AND (extnbr=?);", {event.number()});
+        if(record.count() > 0)
             operAllowed = true;
-        }
-
-        if(!operAllowed) {
-            record = getRecord("SELECT * FROM Groups WHERE (grpnbr=0) AND (extnbr=?);", {event.number()});
-            if(record.count() > 0)
-                operAllowed = true;
-        }
-
-        if(!allowed && !operAllowed) {
-            Context::reply(event, SIP_FORBIDDEN);
-            return;
-        }
+    }
 
-        auto jdoc = QJsonDocument::fromJson(event.body());
-        auto json = jdoc.object();
-        auto userDisplay = json["d"].toString();
-        auto userEmail = json["e"].toString();
-        auto changedAccess = json["a"].toString().toUpper();
-        auto changedSecret = json["s"].toString();
+    if(!allowed && !operAllowed) {
+        Context::reply(event, SIP_FORBIDDEN);
+        return false;
+    }
 
-        if(!changedAccess.isEmpty() && !admin) {
-            Context::reply(event, SIP_FORBIDDEN);
-            return;
-        }
+    auto jdoc = QJsonDocument::fromJson(event.body());
+    auto json = jdoc.object();
+    auto userDisplay = json["d"].toString();
+    auto userEmail = json["e"].toString();
+    auto changedAccess = json["a"].toString().toUpper();
+    auto changedSecret = json["s"].toString();
 
-        if(changedAccess == "LOCAL" && access == "REMOTE") {
-            profile["p"] = "";
-            access = "LOCAL";
-        }
-        else if(changedAccess == "REMOTE" && access == "LOCAL") {
-            access = "REMOTE";
-            profile["p"] = userid + "@" + QString::fromUtf8(Server::sym(CURRENT_NETWORK));
-        }
-        else if(!changedAccess.isEmpty()) {
-            Context::reply(event, SIP_FORBIDDEN);
-            return;
-        }
+    if(!changedAccess.isEmpty() && !admin) {
+        Context::reply(event, SIP_FORBIDDEN);
+        return false;
+    }
 
-        if(changedAccess.isEmpty()) {
-            if(operAllowed || allowed) {
-                if(userDisplay.isEmpty())
-                    userDisplay = altDisplay;
-                profile["d"] = userDisplay;
-            }
-            else
-                userDisplay = profile["d"].toString();
-            if(allowed)
-                profile["e"] = userEmail;
-            else
-                userEmail = profile["e"].toString();
-        }
-        else {
-            userDisplay = profile["d"].toString();
-            userEmail = profile["e"].toString();
-        }
+    if(changedAccess == "LOCAL" && access == "REMOTE")
+        access = "LOCAL";
+    else if(changedAccess == "REMOTE" && access == "LOCAL")
+        access = "REMOTE";
+    else if(!changedAccess.isEmpty()) {
+        Context::reply(event, SIP_FORBIDDEN);
+        return false;
+    }
 
-        if(changedSecret.length() == secret.length() && changedSecret.length() > 0) {
-            emit disconnectEndpoint(endpoint);
-            secret = changedSecret;
+    if(changedAccess.isEmpty()) {
+        if(operAllowed || allowed) {
+            if(userDisplay.isEmpty())
+                userDisplay = altDisplay;
         }
+        else
+            userDisplay = display;
+        if(!allowed)
+            userEmail = email;
+    }
+    else {
+        userDisplay = display;
+        userEmail = email;
+    }
 
-        runQuery("UPDATE Extensions SET display=? WHERE extnbr=?;", {userDisplay, target});
-        runQuery("UPDATE Authorize SET email=?, authaccess=?, secret=? WHERE authname=?;", {userEmail, access, secret, userid});
-
-        Manager::updateRoster();
+    if(changedSecret.length() == secret.length() && changedSecret.length() > 0) {
+        emit disconnectEndpoint(endpoint);
+        secret = changedSecret;
     }
 
-    QJsonDocument jdoc(profile);
-    Context::answerWithJson(event, jdoc.toJson(QJsonDocument::Compact));
+    runQuery("UPDATE Extensions SET display=? WHERE extnbr=?;", {userDisplay, target});
+    runQuery("UPDATE Authorize SET email=?, authaccess=?, secret=? WHERE authname=?;", {userEmail, access, secret, userid});
+
+    refreshExtension(target);
+    Manager::updateRoster();
     qDebug() << "CHANGE PROFILE PROCESSED";
+    return true;
 }
 
 void Database::sendRoster(const Event& event, qlonglong endpoint)
 {
-    QJsonArray list;
-
-    qDebug() << "Seeking roster for" << event.number();
-
-    runQuery("UPDATE Deletes SET delstatus=1 WHERE endpoint=?;", {endpoint});
-    auto deletes = getRecords("SELECT * FROM Deletes WHERE endpoint=?;", {endpoint});
-    while(deletes.isActive() && deletes.next()) {
-        auto record = deletes.record();
-        auto created = record.value("created").toDateTime().toString(Qt::ISODate);
-        auto status = QString("remove");
-        auto user = record.value("authname").toString();
-
-        QJsonObject profile {
-            {"a", user},
-            {"c", created},
-            {"s", "remove"},
-        };
-        list << profile;
-    }
-
-    auto query = getRecords("SELECT * FROM Extensions JOIN Authorize ON Extensions.authname = Authorize.authname ORDER BY Extensions.extnbr");
-    while(query.isActive() && query.next()) {
-        auto record = query.record();
-        auto number = record.value("extnbr").toInt();
-        auto name = record.value("authname").toString();
-        if(name == "anonymous") // skip anon for roster
-            continue;
-
-        auto created = record.value("created").toDateTime().toString(Qt::ISODate);
-        auto display = record.value("display").toString();
-        auto dialing = record.value("extnbr").toString();
-        auto email = record.value("email").toString();
-        auto access = record.value("authaccess").toString();
-        auto publicKey = record.value("pubkey").toByteArray();
-        if(display.isEmpty())
-            display = record.value("fullname").toString();
-        if(display.isEmpty())
-            display = record.value("authname").toString();
-
-        // operators are special
-        if(number == 0) {
-            if(operatorPolicy == "public")
-                display = "Lobby";
-            else
-                display = "Operators";
-        }
-
-        QString puburi;
-        if(record.value("authaccess").toString() == "REMOTE")
-            puburi = name + "@" + QString::fromUtf8(Server::sym(CURRENT_NETWORK));
-
-        UString uri = event.uriTo(dialing);
-        QJsonObject profile {
-            {"a", name},
-            {"k", QString::fromUtf8(publicKey.toHex())},
-            {"c", created},
-            {"n", number},
-            {"u", QString::fromUtf8(uri)},
-            {"d", display},
-            {"t", record.value("authtype").toString()},
-            {"e", email},
-            {"p", puburi},
-        };
-
-        if(number == event.number()) {
-            auto ringPriority = record.value("extpriority").toInt();
-            profile["rp"] = ringPriority;
-        }
-
-        // qDebug() << "*** CONTACT" << profile;
-        list << profile;
-    }
-    qDebug() << "Extension list" << list.count();
-    QJsonDocument jdoc(list);
-    auto json = jdoc.toJson(QJsonDocument::Compact);
-    Context::answerWithJson(event, json);
+    read(event, Request::Roster, endpoint);
 }
 
+// connections are kept open, with their statements, when idle
 void Database::onTimeout()
 {
-    if(isFile())
-        close();
+    auto stats = statements.stats();
+    if(stats.hits + stats.misses)
+        debug() << "Database: statement hits=" << stats.hits << ", misses=" << stats.misses << ", cached=" << stats.size << ", rate=" << (stats.hits * 100) / (stats.hits + stats.misses) << "%";
+
+    if(writeStats.batches)
+        debug() << "Database: commits=" << writeStats.batches << ", avg writes=" << writeStats.writes / writeStats.batches << ", avg=" << writeStats.nsecs / static_cast<qint64>(writeStats.batches) << "ns, max=" << writeStats.highest << "ns";
+
+    if(expiredRequests)
+        debug() << "Database: expired requests=" << expiredRequests;
 }
 
 void Database::applyConfig(const QVariantHash& config)
@@ -1686,6 +1790,17 @@ void Database::applyConfig(const QVariantHash& config)
 
     create();
     emit updateAuthorize(config, db.isOpen());
+    emit updateReaders({
+        {"open", db.isOpen()},
+        {"driver", dbDriver},
+        {"name", dbName},
+        {"host", dbHost},
+        {"port", dbPort},
+        {"username", dbUser},
+        {"password", dbPass},
+        {"operators", operatorPolicy},
+        {"display", operatorDisplay},
+    });
 }
 
 void Database::countExtensions()
@@ -1694,3 +1809,77 @@ void Database::countExtensions()
     QCoreApplication::postEvent(Instance,
         new DatabaseEvent(COUNT_EXTENSIONS));
 }
+
+// requests made on the database thread, after it's own writes, are not
+// queued behind other events
+void Database::submit(Request *request)
+{
+    Q_ASSERT(Instance != nullptr);
+    Q_ASSERT(request != nullptr);
+    if(QThread::currentThread() == Instance->thread()) {
+        Instance->query(request);
+        return;
+    }
+
+    QCoreApplication::postEvent(Instance,
+        new DatabaseEvent(QUERY_REQUEST, request));
+}
+
+// results are posted back to the requestor by the reader, so the database
+// thread never runs or waits on a query
+void Database::query(Request *request)
+{
+    if(!request)
+        return;
+
+    if(request->isExpired()) {
+        qDebug() << "Dropping expired request after" << request->event().elapsed() << "msecs";
+        if(!request->cancelled())
+            request->notifyFailed(Request::Timeout);
+        return;
+    }
+
+    auto endpoint = request->endpoint();
+    switch(request->reading()) {
+    case Request::Roster:
+        write("UPDATE Deletes SET delstatus=1 WHERE endpoint=?;", {endpoint});
+        break;
+    case Request::Pending:
+        // given that we have requested pending we can clean any already
+        // sent roster deletions...
+        write("DELETE FROM Deletes WHERE (delstatus=1) AND (endpoint=?);", {endpoint});
+        break;
+    default:
+        break;
+    }
+
+    QMetaObject::invokeMethod(reader(), "query", Qt::QueuedConnection, Q_ARG(Request *, request));
+}
+
+// a sip event answered by a reader, which we wait for only to count
+void Database::read(const Event& event, Request::Reading reading, qlonglong endpoint)
+{
+    auto request = new Request(this, event, reading, endpoint);
+    connect(request, &Request::results, this, &Database::answered);
+    submit(request);
+}
+
+void Database::answered(Request::ErrorResult error, const Event& event, const QList<QSqlRecord>& records)
+{
+    Q_UNUSED(records);
+    if(error == Request::Timeout) {
+        qDebug() << "Request expired after" << event.elapsed() << "msecs";
+        ++expiredRequests;
+    }
+}
+
+// a sip request that timed out while queued is not worth a query
+bool Database::expired(const Event& event)
+{
+    if(!Request::isExpired(event))
+        return false;
+
+    qDebug() << "Dropping expired request after" << event.elapsed() << "msecs";
+    ++expiredRequests;
+    return true;
+}
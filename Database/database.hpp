@@ -20,19 +20,31 @@
 
 #include "request.hpp"
 #include "sqldriver.hpp"
+#include "statements.hpp"
+#include "../Server/scheduler.hpp"
 
 #include <QObject>
 #include <QString>
 #include <QDebug>
 #include <QSqlDatabase>
+#include <QElapsedTimer>
+#include <functional>
+
+class Reader;
 
 class Database final : public QObject
 {
     Q_OBJECT
     Q_DISABLE_COPY(Database)
     friend class Authorize;
+    friend class Reader;
 
 public:
+    using WriteStats = struct {
+        quint64 batches, writes;
+        qint64 nsecs, highest;          // commit latency
+    };
+
     ~Database() final;
 
     bool isFile() const {
@@ -45,7 +57,12 @@ public:
 
     static void init(unsigned order);
 
+    inline Scheduler *queues() const {
+        return scheduler;
+    }
+
     static void countExtensions();
+    static void submit(Request *request);
 
     static QPair<int,int> range() {
         if(!Instance)
@@ -67,12 +84,27 @@ public:
     }
 
 private:
-    static const int interval = 10000;
+    using Write = struct {
+        QString request, prefix;        // prefix of a multi-row insert
+        QVariantList parms;
+        int rows;
+    };
+
+    static const int interval = 60000;     // statement stats...
 
     QString operatorPolicy, operatorDisplay;
     QSqlDatabase db;
+    Statements statements;
     QSqlRecord dbConfig;
-    QTimer dbTimer;
+    QTimer dbTimer, writeTimer, retainTimer;
+    QList<Write> writes;                // write behind, in order
+    QList<std::function<void(bool)>> commits;
+    WriteStats writeStats;
+    quint64 expiredRequests;            // dropped before being queried
+    Scheduler *scheduler;
+    qlonglong lastMid;                  // messages ids we assign
+    QList<Reader *> readers;
+    int nextReader;
     QString dbUuid;
     QString dbRealm;
     QString dbDriver;
@@ -96,15 +128,30 @@ private:
     QVariant insert(const QString& request, const QVariantList &parms = QVariantList());
     QSqlRecord getRecord(const QString& request, const QVariantList &parms = QVariantList());
     QSqlQuery getRecords(const QString& request, const QVariantList& parms = QVariantList());
+    void write(const QString& request, const QVariantList& parms = QVariantList());
+    void write(const QString& prefix, const QString& row, const QVariantList& parms);
+    void afterCommit(const std::function<void(bool)>& notify);
+    void flush();
+    Reader *reader();
+    bool changeProfile(const Event& ev, const UString& auth, qlonglong endpoint, int target);
     bool resume();
     bool reopen();
     bool create();
     void close();
+    void upgrade();
+    void loadDirectory();
+    void query(Request *request);
+    void read(const Event& ev, Request::Reading reading, qlonglong endpoint = -1);
+    bool expired(const Event& ev);
+
+    static qlonglong cursor(const Event& ev);
+    static QString mailboxes(const QString& extension);
 
     static Database *Instance;
 
 signals:
     void updateAuthorize(const QVariantHash& config, bool active);
+    void updateReaders(const QVariantHash& settings);
     void sendMessage(qlonglong endpoint, const QVariantHash& data);
     void disconnectEndpoint(qlonglong endpoint);
 
@@ -114,12 +161,16 @@ public slots:
     void copyOutbox(qlonglong source, qlonglong target);
     void syncOutbox(qlonglong endpoint);
     void messageResponse(const QByteArray& mid, const QByteArray &ep, int status);
+    void refreshExtension(int number);
+    void refreshAccount(const QString& name);
 
 private slots:
     void cleanupMessages();
+    void answered(Request::ErrorResult error, const Event& ev, const QList<QSqlRecord>& records);
     void sendRoster(const Event& ev, qlonglong endpoint);
     void sendProfile(const Event& ev, const UString& auth, qlonglong endpoint);
     void sendPending(const Event& ev, qlonglong endpoint);
+    void markPending(qlonglong endpoint, qlonglong after, qlonglong last);
     void removeDevice(const Event& ev, const UString& auth, qlonglong endpoint);
     void dropExtension(const Event& ev, const UString& auth, qlonglong endpoint);
     void changeAdmin(const Event& ev, const UString& auth, qlonglong endpoint);
@@ -129,7 +180,7 @@ private slots:
     void changeTopic(const Event& ev);
     void changeAuthorize(const Event& ev);
     void sendDeviceList(const Event& ev);
-    void changePending(qlonglong endpoint);
+    void changePending(const Event& ev, qlonglong endpoint);
     void lastAccess(qlonglong endpoint, const QDateTime& timestamp, const QString& agent, const QByteArray &deviceKey, const QString& uri);
     void applyConfig(const QVariantHash& config);
     void onTimeout();
@@ -153,6 +204,45 @@ private slots:
  * process special requests objects.  Query/response thru a separate thread
  * allows fully asychronous operations with other services that may have their
  * own thread contexts and event loops, such as the stack manager.
+ *
+ * The database thread also owns the in-memory Directory, and refreshes it
+ * whenever it changes the tables the directory is built from.
+ *
+ * Message, outbox, and endpoint status writes are queued and committed
+ * together in one transaction, once a short window passes or enough are
+ * queued, with adjacent inserts into the same table sent as one multi-row
+ * statement.  Message ids are assigned by the database thread so that a
+ * message and it's outboxes need not wait for an insert.  Any other query
+ * commits the queue first, so reads such as pending delivery always see
+ * every earlier write, and work that depends on a write, such as replying
+ * or delivering a message, is done only after it commits.
+ *
+ * Large read-only replies, such as rosters, device lists, pending messages,
+ * and profiles, are handed to a pool of Reader connections once any queued
+ * writes are committed, while every write stays on the database thread.
+ *
+ * Messages to an extension or group are pending for endpoints thru the
+ * mailbox they are posted to, and each endpoint keeps a watermark of the
+ * last message it acknowledged.  Only exceptions, such as messages to named
+ * targets and deliveries out of order with the mark, are kept as outbox
+ * rows.  A live delivery with nothing else pending under it just advances
+ * the mark, so posting to a large group or the lobby writes one message
+ * rather than a row for every device.
+ *
+ * Reads that answer a sip transaction, such as rosters, profiles, device
+ * lists and pending messages, are submitted as Request objects carrying
+ * the deadline of their transaction.  Those that time out while queued are
+ * dropped before any sql is run, as nobody is left to answer.  The rest
+ * are run by a reader, and their results posted back to the thread of the
+ * requestor, so the database thread never runs or waits on them.
+ *
+ * Requests from the stack and contexts are routed thru a Scheduler, which
+ * keeps registration, messaging, and control requests in their own queues,
+ * so that a burst of control requests cannot hold messaging behind it.
+ *
+ * Message retention is enforced continuously in the background, deleting
+ * a bounded range of the oldest message ids at a time, so that expiring a
+ * large backlog never holds other work behind it for long.
  * \author David Sugar <tychosoft@gmail.com>
  */
 
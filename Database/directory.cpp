@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directory.hpp"
+
+#include <atomic>
+
+namespace {
+std::shared_ptr<const Directory> published;
+} // namespace
+
+std::shared_ptr<const Directory> Directory::current()
+{
+    auto directory = std::atomic_load(&published);
+    if(!directory)
+        return std::shared_ptr<const Directory>(new Directory());
+    return directory;
+}
+
+void Directory::publish(std::shared_ptr<Directory> directory)
+{
+    auto prior = std::atomic_load(&published);
+    if(prior) {
+        directory->origin = prior->origin;
+        directory->serial = prior->serial + 1;
+    }
+    else
+        directory->origin = directory->serial = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
+
+    foreach(auto number, directory->touched)
+        directory->revisions[number] = directory->serial;
+    directory->touched.clear();
+    std::atomic_store(&published, std::shared_ptr<const Directory>(directory));
+}
+
+const Directory::Extension *Directory::extension(int number) const
+{
+    auto ext = extensionMap.constFind(number);
+    if(ext == extensionMap.constEnd())
+        return nullptr;
+    return &(*ext);
+}
+
+const Directory::Account *Directory::account(const QString& name) const
+{
+    auto auth = accounts.constFind(name);
+    if(auth == accounts.constEnd())
+        return nullptr;
+    return &(*auth);
+}
+
+qlonglong Directory::endpoint(int number, const QString& label) const
+{
+    foreach(const auto& ep, endpointMap.value(number)) {
+        if(ep.label == label)
+            return ep.endpoint;
+    }
+    return -1;
+}
+
+QList<qlonglong> Directory::labeled() const
+{
+    QList<qlonglong> list;
+    for(auto eps = endpointMap.constBegin(); eps != endpointMap.constEnd(); ++eps) {
+        foreach(const auto& ep, *eps) {
+            if(ep.label != "NONE")
+                list << ep.endpoint;
+        }
+    }
+    return list;
+}
+
+QList<int> Directory::changed(quint64 since) const
+{
+    QList<int> list;
+    for(auto ext = extensionMap.constBegin(); ext != extensionMap.constEnd(); ++ext) {
+        if(revisions.value(ext.key()) > since)
+            list << ext.key();
+    }
+    return list;
+}
+
+void Directory::insert(const Account& auth)
+{
+    accounts.insert(auth.name, auth);
+    foreach(auto number, accountMap.values(auth.name))
+        touched << number;
+}
+
+void Directory::insert(const Extension& ext)
+{
+    auto prior = extensionMap.constFind(ext.number);
+    if(prior != extensionMap.constEnd())
+        accountMap.remove(prior->name, ext.number);
+    extensionMap.insert(ext.number, ext);
+    accountMap.insert(ext.name, ext.number);
+    touched << ext.number;
+}
+
+// as the database cascades deletes of an extension
+void Directory::remove(int number)
+{
+    auto ext = extensionMap.constFind(number);
+    if(ext != extensionMap.constEnd())
+        accountMap.remove(ext->name, number);
+    extensionMap.remove(number);
+    endpointMap.remove(number);
+    groupMap.remove(number);
+    admins.remove(number);
+    revisions.remove(number);
+    touched.remove(number);
+    for(auto group = groupMap.begin(); group != groupMap.end(); ++group)
+        group->removeAll(number);
+}
+
+void Directory::remove(const QString& name)
+{
+    foreach(auto number, accountMap.values(name))
+        remove(number);
+    accounts.remove(name);
+}
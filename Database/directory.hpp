@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIRECTORY_HPP_
+#define DIRECTORY_HPP_
+
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QList>
+#include <memory>
+
+class Directory final
+{
+    friend class Database;
+
+public:
+    using Account = struct {
+        QString name, type, digest, realm, secret, access, email, fullname;
+        QDateTime created;
+    };
+
+    using Extension = struct {
+        int number;
+        int priority;
+        QString name, display;
+        QByteArray publicKey;
+    };
+
+    using Endpoint = struct {
+        qlonglong endpoint;
+        QString label;
+    };
+
+    inline quint64 version() const {
+        return serial;
+    }
+
+    inline quint64 revision(int number) const {
+        return revisions.value(number);
+    }
+
+    inline bool isCurrent(quint64 since) const {
+        return since >= origin && since <= serial;
+    }
+
+    inline const QMap<int, Extension>& list() const {
+        return extensionMap;
+    }
+
+    inline QList<Endpoint> endpoints(int number) const {
+        return endpointMap.value(number);
+    }
+
+    inline QList<int> members(int group) const {
+        return groupMap.value(group);
+    }
+
+    inline QList<int> extensions(const QString& name) const {
+        return accountMap.values(name);
+    }
+
+    inline bool isAdmin(int number) const {
+        return admins.contains(number);
+    }
+
+    inline bool isOperator(int number) const {
+        return groupMap.value(0).contains(number);
+    }
+
+    const Extension *extension(int number) const;
+    const Account *account(const QString& name) const;
+    qlonglong endpoint(int number, const QString& label) const;
+    QList<qlonglong> labeled() const;
+    QList<int> changed(quint64 since) const;
+
+    static std::shared_ptr<const Directory> current();
+
+private:
+    QMap<int, Extension> extensionMap;
+    QHash<QString, Account> accounts;
+    QMultiHash<QString, int> accountMap;        // extensions by authname
+    QHash<int, QList<Endpoint>> endpointMap;    // endpoints by extension
+    QHash<int, QList<int>> groupMap;            // members by group
+    QSet<int> admins;                           // system admins
+    QHash<int, quint64> revisions;              // version extension changed
+    QSet<int> touched;                          // changed since published
+    quint64 serial, origin;
+
+    Directory() : serial(0), origin(0) {}
+
+    void insert(const Account& auth);
+    void insert(const Extension& ext);
+    void remove(int number);
+    void remove(const QString& name);
+
+    static void publish(std::shared_ptr<Directory> directory);
+};
+
+/*!
+ * In-memory copy of the extension directory.
+ * \file directory.hpp
+ */
+
+/*!
+ * \class Directory
+ * \brief An immutable snapshot of the extension directory.
+ * The directory holds the Extensions, Authorize, Endpoints, and Groups
+ * tables, and system admins, as they are needed to authorize endpoints,
+ * route local messages, and build rosters, so that those paths need no
+ * sql.  It is loaded by the database thread when the database is created,
+ * and whenever the database thread changes these tables it copies the
+ * current snapshot, reloads only the affected extension or account, and
+ * publishes the result as a new version.  Any thread may take a reference
+ * to the current snapshot, which is released when it's last reader is done.
+ *
+ * Each extension records the version it last changed in, so that a client
+ * that knows an earlier version of the same directory can be sent only what
+ * changed since.  Versions start from the time the server loads the first
+ * directory, so versions from before a restart are never current.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Directory::endpoint(int number, const QString& label)
+ * \return endpoint id for an extension's labeled device, or -1.
+ *
+ * \fn Directory::labeled()
+ * \return every labeled endpoint, as for the public lobby.
+ *
+ * \fn Directory::changed(quint64 since)
+ * \param since A current version the caller already has.
+ * \return extensions changed after that version, in number order.
+ */
+
+#endif
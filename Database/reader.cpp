@@ -0,0 +1,663 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../Common/compiler.hpp"
+#include "../Server/server.hpp"
+#include "../Server/output.hpp"
+#include "../Server/manager.hpp"
+#include "../Server/main.hpp"
+#include "sqldriver.hpp"
+#include "database.hpp"
+#include "directory.hpp"
+#include "reader.hpp"
+
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <osipparser2/osip_headers.h>
+
+#define ROSTER_FORMS 8      // uri forms of roster entries kept...
+#define PENDING_PAGE 100    // most messages in a pending page...
+#define PENDING_SIZE 32768  // text in a pending page before we end it...
+
+Reader::Reader(unsigned order, int id) :
+name(QString("reader%1").arg(id)), failed(false)
+{
+    moveToThread(Server::createThread(name, order));
+
+    connect(thread(), &QThread::finished, this, &QObject::deleteLater);
+    connect(Database::instance(), &Database::updateReaders, this, &Reader::activate);
+}
+
+Reader::~Reader()
+{
+    close();
+}
+
+void Reader::close()
+{
+    if(db.isValid() && db.isOpen()) {
+        report();
+        statements.clear();
+        db.close();
+    }
+    if(db.isValid()) {
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(name);
+    }
+}
+
+void Reader::report()
+{
+    auto stats = statements.stats();
+    if(stats.hits + stats.misses)
+        debug() << "Reader(" << name << "): statement hits=" << stats.hits << ", misses=" << stats.misses << ", cached=" << stats.size << ", rate=" << (stats.hits * 100) / (stats.hits + stats.misses) << "%";
+}
+
+void Reader::activate(const QVariantHash& settings)
+{
+    close();
+    rosters.clear();
+    operatorPolicy = settings["operators"].toString();
+    operatorDisplay = settings["display"].toString();
+    if(!settings["open"].toBool())
+        return;
+
+    auto driver = settings["driver"].toString();
+    db = QSqlDatabase::addDatabase(driver, name);
+    if(!db.isValid()) {
+        error() << "Invalid " << name << " connection";
+        failed = true;
+        return;
+    }
+
+    db.setDatabaseName(settings["name"].toString());
+    if(!Util::dbIsFile(driver)) {
+        auto host = settings["host"].toString();
+        auto port = settings["port"].toInt();
+        auto user = settings["username"].toString();
+        auto pass = settings["password"].toString();
+        if(!host.isEmpty())
+            db.setHostName(host);
+        if(port)
+            db.setPort(port);
+        if(!user.isEmpty())
+            db.setUserName(user);
+        if(!pass.isEmpty())
+            db.setPassword(pass);
+    }
+
+    failed = !db.open();
+    if(failed) {
+        error() << "Failed " << name << " connection; " << db.lastError().text();
+        return;
+    }
+
+    // readers never write, even by mistake...
+    if(Util::dbIsFile(driver)) {
+        QSqlQuery query(db);
+        query.exec("PRAGMA query_only = ON;");
+    }
+    qDebug() << "Database reader activated" << name;
+}
+
+bool Reader::resume()
+{
+    if(failed || !db.isValid())
+        return false;
+
+    statements.clear();
+    db.close();
+    return checkConnection();
+}
+
+bool Reader::checkConnection()
+{
+    if(!db.isValid())
+        return false;
+
+    if(db.isOpen())
+        return true;
+
+    qDebug() << "Reader(RE-CONNECT)" << name;
+    statements.clear();
+    if(!db.open()) {
+        failed = true;
+        error() << "Reader " << name << " connection failed";
+        return false;
+    }
+    failed = false;
+    return true;
+}
+
+QSqlQuery Reader::getRecords(const QString& request, const QVariantList& parms)
+{
+    if(!checkConnection())
+        return QSqlQuery();
+
+    for(unsigned retries = 0; retries < 3; ++retries) {
+        auto query = statements.prepare(db, request);
+        int count = -1;
+        qDebug() << "Query " << request << " LIST " << parms;
+        while(++count < parms.count())
+            query.bindValue(count, parms.at(count));
+
+        if(!query.exec()) {
+            if(!retries)
+                warning() << "Query failed; " << query.lastError().text() << " for " << query.lastQuery();
+            if(resume())
+                continue;
+            break;
+        }
+        return query;
+    }
+    return QSqlQuery();
+}
+
+QSqlRecord Reader::getRecord(const QString& request, const QVariantList &parms)
+{
+    if(!checkConnection())
+        return QSqlRecord();
+
+    for(unsigned retries = 0; retries < 3; ++retries) {
+        auto query = statements.prepare(db, request);
+        int count = -1;
+        qDebug() << "Request " << request << " LIST " << parms;
+        while(++count < parms.count())
+            query.bindValue(count, parms.at(count));
+
+        if(!query.exec()) {
+            if(!retries)
+                warning() << "Query failed; " << query.lastError().text() << " for " << query.lastQuery();
+            if(resume())
+                continue;
+            break;
+        }
+
+        QSqlRecord record;
+        if(query.next())
+            record = query.record();
+        query.finish();
+        return record;
+    }
+    return QSqlRecord();
+}
+
+// results, or that the event was answered, go back to the requestor
+void Reader::query(Request *request)
+{
+    if(request->isExpired()) {          // timed out waiting for a reader
+        qDebug() << "Dropping expired request after" << request->event().elapsed() << "msecs";
+        if(!request->cancelled())
+            request->notifyFailed(Request::Timeout);
+        return;
+    }
+
+    auto& event = request->event();
+    switch(request->reading()) {
+    case Request::Roster:
+        sendRoster(event, request->endpoint());
+        break;
+    case Request::Profile:
+        sendProfile(event);
+        break;
+    case Request::Devlist:
+        sendDeviceList(event);
+        break;
+    case Request::Pending:
+        sendPending(event, request->endpoint());
+        break;
+    default: {
+        auto results = getRecords(request->query(), request->parms());
+        if(!results.isActive()) {
+            request->notifyFailed(Request::Invalid);
+            return;
+        }
+        request->notifySuccess(results);
+        results.finish();
+        return;
+    }
+    }
+    request->notifyAnswered();
+}
+
+void Reader::sendDeviceList(const Event& event)
+{
+    qDebug() << "Seeking device list";
+
+    auto query = getRecords("SELECT * FROM Endpoints WHERE extnbr=?;", {event.number()});
+
+    QJsonArray list;
+    while(query.isActive() && query.next()) {
+        qDebug() << "QUERY" << query.record();
+        auto record = query.record();
+        auto endpoint = record.value("endpoint").toString();
+        auto extension = record.value("extnbr").toString();
+        auto label = record.value("label").toString();
+        auto agent = record.value("agent").toString();
+        auto resgistrated = record.value("created").toString();
+        auto lastOnline = record.value("lastaccess").toString();
+        auto lastUri = record.value("lastUri").toString();
+
+        QJsonObject profile {
+            {"e", endpoint},
+            {"n", extension},
+            {"u", label},
+            {"a", agent},
+            {"l", lastUri},
+            {"r", resgistrated},
+            {"o", lastOnline},
+        };
+        list << profile;
+    }
+    QJsonDocument jdoc(list);
+    auto json = jdoc.toJson(QJsonDocument::Compact);
+    Context::answerWithJson(event, json);
+}
+
+// a page of pending messages after the client's cursor, if it has one
+void Reader::sendPending(const Event& event, qlonglong endpoint)
+{
+    auto after = Database::cursor(event);
+    qDebug() << "Seeking pending for " << event.number() << event.label() << "after" << after;
+
+    // mailbox messages are pending above the endpoint's delivery mark...
+    auto number = event.number();
+    auto mark = getRecord("SELECT delivered FROM Endpoints WHERE endpoint=?;", {endpoint}).value("delivered").toLongLong();
+    if(mark < after)
+        mark = after;
+
+    // get a page of pending (unsent) messages, from outbox exceptions and
+    // from mailboxes, and one more to see if there are more...
+    auto query = getRecords(
+        "SELECT Messages.mid AS mid, msgseq, msgfrom, msgto, subject, display, posted, msgtype, msgtext, expires "
+        "FROM Outboxes JOIN Messages ON Outboxes.mid = Messages.mid "
+        "WHERE endpoint=? AND msgstatus != 200 AND Outboxes.mid > ? "
+        "UNION ALL "
+        "SELECT Messages.mid AS mid, msgseq, msgfrom, msgto, subject, display, posted, msgtype, msgtext, expires "
+        "FROM Messages LEFT JOIN Outboxes ON Outboxes.mid = Messages.mid AND Outboxes.endpoint=? "
+        "WHERE Outboxes.endpoint IS NULL AND Messages.mid > ? AND Messages.mailbox IS NOT NULL AND " +
+        Database::mailboxes("?") + " "
+        "ORDER BY mid LIMIT ?;", {
+            endpoint, after,
+            endpoint, mark,
+            number, number, number, number,
+            (operatorPolicy == "public") ? 1 : 0,
+            PENDING_PAGE + 1,
+        });
+
+    QList<QJsonObject> page;
+    qlonglong last = after;
+    auto size = 0;
+    auto more = false;
+    while(query.isActive() && query.next()) {
+        if(page.count() >= PENDING_PAGE || size >= PENDING_SIZE) {
+            more = true;
+            break;
+        }
+
+        auto record = query.record();
+        auto text = record.value("msgtext").toString();
+        QJsonObject message {
+            {"f", record.value("msgfrom").toString()},
+            {"t", record.value("msgto").toString()},
+            {"d", record.value("display").toString()},
+            {"b", text},
+            {"c", record.value("msgtype").toString()},
+            {"s", record.value("subject").toString()},
+            {"p", record.value("posted").toDateTime().toString(Qt::ISODate)},
+            {"u", record.value("msgseq").toInt()},
+            {"e", record.value("expires").toDateTime().toString(Qt::ISODate)},
+        };
+
+        // qDebug() << "*** PENDING" << message << record.value("msgstatus").toInt();
+        last = record.value("mid").toLongLong();
+        size += text.size();
+        page << message;
+    }
+    query.finish();
+
+    if(page.isEmpty()) {
+        Context::reply(event, SIP_OK);
+        return;
+    }
+
+    // mark what we sent in this page as 100/in progress, which is queued
+    // to the database thread ahead of any change the client sends back...
+    auto database = Database::instance();
+    database->scheduler->post(Scheduler::MESSAGING, [database, endpoint, after, last]() {
+        database->markPending(endpoint, after, last);
+    });
+
+    // each page is sent in reverse order...
+    QJsonArray list;
+    for(auto pos = page.count(); pos > 0; --pos)
+        list << page[pos - 1];
+
+    QList<QPair<UString, UString>> headers = {{"X-Cursor", UString::number(last)}};
+    if(more)
+        headers << qMakePair(UString("X-More"), UString("true"));
+
+    QJsonDocument jdoc(list);
+    Context::answerWithJson(event, jdoc.toJson(QJsonDocument::Compact), headers);
+}
+
+void Reader::sendProfile(const Event& event)
+{
+    auto target = atoi(event.message()->to->url->username);
+    auto number = event.number();
+
+    auto record = getRecord("SELECT * FROM Extensions JOIN Authorize ON Extensions.authname = Authorize.authname WHERE Extensions.extnbr=?;", {target});
+    if(record.count() < 1) {
+        Context::reply(event, SIP_NOT_FOUND);
+        return;
+    }
+
+    auto type = record.value("authtype").toString();
+    auto access = record.value("authaccess").toString();
+    auto created = record.value("created").toDateTime().toString(Qt::ISODate);
+    auto display = record.value("display").toString();
+    if(display.isEmpty())
+        display = record.value("fullname").toString();
+    if(display.isEmpty())
+        display = record.value("authname").toString();
+    auto uri = event.uriTo(record.value("extnbr").toString());
+    auto email = record.value("email").toString();
+    auto userid = record.value("authname").toString();
+    auto ringPriority = record.value("extpriority").toInt();
+    auto publicKey = record.value("pubkey").toByteArray();
+
+    auto fwdBusy = record.value("fwdbusy").toInt();
+    auto fwdNoAnswer = record.value("fwdnoanswer").toInt();
+    auto fwdAway = record.value("fwdaway").toInt();
+    auto coverage = -1, groupPriority = -1;
+
+    // what is my call priority in group xxx?
+    if(type == "GROUP" || type == "PILOT" || target == 0) {
+        auto calling = getRecord("SELECT extpriority FROM Groups WHERE (grpnbr=?) and (extnbr=?);", {target, number});
+        if(calling.count() > 0) {
+            if(target == 0)             // operators always do immediate coverage
+                groupPriority = 0;
+            else
+                groupPriority = calling.value("extpriority").toInt();
+        }
+    }
+    auto calling = getRecord("SELECT extpriority FROM Calling WHERE (authname=?) and (extnbr=?);", {userid, number});
+    if(calling.count() > 0)
+        coverage = calling.value("extpriority").toInt();
+
+    if(coverage > 3)
+        coverage = 3;
+    else if(coverage < 0)
+        coverage = -1;
+
+    if(groupPriority > 3)
+        groupPriority = 3;
+    else if(groupPriority < 0)
+        groupPriority = -1;
+
+    if(ringPriority > 3)
+        ringPriority = 3;
+    else if(ringPriority < 0)
+        ringPriority = -1;
+
+    QString info, puburi;
+    if(access == "REMOTE")
+        puburi = userid + "@" + QString::fromUtf8(Server::sym(CURRENT_NETWORK));
+
+    auto privs = QString("none");
+    if(access == "SUSPEND")
+        privs = "suspend";
+    else {
+        auto admin = getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {target});
+        if(admin.count() > 0)
+            privs = "sysadmin";
+        else {
+            auto oper = getRecord("SELECT * FROM Groups WHERE (grpnbr=0) AND (extnbr=?);", {target});
+            if(oper.count() > 0)
+                privs = "operator";
+        }
+    }
+
+    auto groupAccess = QString("none");
+    auto groupList = QString("");
+
+    if(type == "GROUP" || type == "PILOT" || target == 0) {
+        auto listAccess = false;
+        auto admin = getRecord("SELECT * FROM Admin WHERE (authname=?) AND (extnbr=?);", {userid, event.number()});
+        if(admin.count() > 0) {
+            listAccess = true;
+            groupAccess = "admin";
+        }
+        else {
+            auto member = getRecord("SELECT * FROM Groups WHERE (grpnbr=?) AND (extnbr=?);", {target, event.number()});
+            if(member.count() > 0) {
+                listAccess = true;
+                groupAccess = "member";
+                auto groupAdmin = getRecord("SELECT * FROM Admin WHERE (authname=?);", {userid});
+                if(groupAdmin.count() > 0)
+                    groupAccess = groupAdmin.value("extnbr").toString();
+            }
+        }
+        if(!listAccess) {
+            auto sysop = getRecord("SELECT * FROM Admin WHERE (authname='system') AND (extnbr=?);", {event.number()});
+            if(sysop.count() > 0)
+                listAccess = true;
+        }
+        if(listAccess) {
+            auto query = getRecords("SELECT * FROM Groups WHERE (grpnbr=?);", {target});
+            const char *sep = "";
+            while(query.isActive() && query.next()) {
+                auto member = query.record();
+                groupList += sep + member.value("extnbr").toString();
+                sep = ",";
+            }
+        }
+    }
+    // operators are special...
+    if(target == 0)
+        display = operatorDisplay;
+
+    QJsonObject profile {
+        {"a", userid},
+        {"c", created},
+        {"k", QString::fromUtf8(publicKey.toHex())},
+        {"n", target},
+        {"d", display},
+        {"g", groupAccess},
+        {"m", groupList},
+        {"u", QString::fromUtf8(uri)},
+        {"t", type},
+        {"e", email},
+        {"p", puburi},
+        {"i", info},
+        {"s", privs},
+        {"busy", fwdBusy},
+        {"noanswer", fwdNoAnswer},
+        {"away", fwdAway},
+        {"cc", coverage},
+        {"gp", groupPriority},
+        {"rp", ringPriority},
+    };
+
+    // self query
+    if(target == event.number()) {
+        auto speeds = getRecords("SELECT extnbr,target FROM Speeds WHERE (authname=?) AND (extnbr < 10);", {userid});
+        while(speeds.isActive() && speeds.next()) {
+            auto item = speeds.record();
+            auto speedDial = item.value("extnbr").toString();
+            if(speedDial < "1")
+                continue;
+            profile[speedDial] = item.value("target").toString();
+        }
+
+        // self device list...
+        QJsonArray devices;
+        auto query = getRecords("SELECT * FROM Endpoints WHERE (extnbr=?) AND (label != 'NONE') AND (label != ?) ORDER BY label;", {event.number(), event.label()});
+        while(query.isActive() && query.next()) {
+            auto devitem = query.record();
+            auto devendpoint = devitem.value("endpoint").toString();
+            auto label = devitem.value("label").toString();
+            auto agent = devitem.value("agent").toString();
+            auto resgistrated = devitem.value("created").toString();
+            auto lastOnline = devitem.value("lastaccess").toString();
+            auto lastUri = devitem.value("lasturi").toString();
+            auto deviceKey = devitem.value("devkey").toByteArray();
+
+            QJsonObject device {
+                {"e", devendpoint},
+                {"k", QString(deviceKey.toHex())},
+                {"u", label},
+                {"a", agent},
+                {"r", resgistrated},
+                {"l", lastUri},
+                {"o", lastOnline},
+            };
+            devices << device;
+        }
+        profile["ep"] = devices;
+    }
+
+    QJsonDocument jdoc(profile);
+    Context::answerWithJson(event, jdoc.toJson(QJsonDocument::Compact));
+    qDebug() << "PROFILE PROCESSED";
+}
+
+// deletes for the endpoint, then extensions changed since the client's
+// version, or all of them, with the server's version in the reply.
+void Reader::sendRoster(const Event& event, qlonglong endpoint)
+{
+    qDebug() << "Seeking roster for" << event.number();
+
+    auto directory = Directory::current();
+    auto version = directory->version();
+    quint64 since = 0;
+    osip_header_t *header = nullptr;
+    osip_message_header_get_byname(event.sent(), "x-roster", 0, &header);
+    if(header && header->hvalue)
+        since = UString(header->hvalue).toULongLong();
+
+    // a client too far behind, such as from before a restart, gets it all
+    if(!directory->isCurrent(since))
+        since = 0;
+
+    QByteArray json("[");
+    auto count = 0;
+    auto append = [&json, &count](const QByteArray& item) {
+        if(count++)
+            json += ",";
+        json += item;
+    };
+
+    auto deletes = getRecords("SELECT * FROM Deletes WHERE endpoint=?;", {endpoint});
+    while(deletes.isActive() && deletes.next()) {
+        auto record = deletes.record();
+        auto created = record.value("created").toDateTime().toString(Qt::ISODate);
+        auto user = record.value("authname").toString();
+
+        QJsonObject profile {
+            {"a", user},
+            {"c", created},
+            {"s", "remove"},
+        };
+        append(QJsonDocument(profile).toJson(QJsonDocument::Compact));
+    }
+
+    // entries are kept for each form of uri, by host or address, requested
+    auto form = event.uriTo(UString());
+    if(!rosters.contains(form) && rosters.count() >= ROSTER_FORMS)
+        rosters.clear();
+    auto& cache = rosters[form];
+
+    auto numbers = since ? directory->changed(since) : directory->list().keys();
+    foreach(auto number, numbers) {
+        auto ext = directory->extension(number);
+        auto auth = directory->account(ext->name);
+        if(!auth || ext->name == "anonymous")   // skip anon for roster
+            continue;
+
+        if(number == event.number()) {
+            auto profile = roster(event, *ext, *auth);
+            profile["rp"] = ext->priority;
+            append(QJsonDocument(profile).toJson(QJsonDocument::Compact));
+            continue;
+        }
+
+        auto revision = directory->revision(number);
+        auto& entry = cache[number];
+        if(entry.json.isEmpty() || entry.revision != revision) {
+            entry.revision = revision;
+            entry.json = QJsonDocument(roster(event, *ext, *auth)).toJson(QJsonDocument::Compact);
+        }
+        append(entry.json);
+    }
+
+    // drop entries of extensions since removed
+    if(!since) {
+        for(auto entry = cache.begin(); entry != cache.end();) {
+            if(!directory->extension(entry.key()))
+                entry = cache.erase(entry);
+            else
+                ++entry;
+        }
+    }
+
+    json += "]";
+    qDebug() << "Extension list" << count << "since" << since;
+    Context::answerWithJson(event, json, {{"X-Roster", UString::number(version)}});
+}
+
+QJsonObject Reader::roster(const Event& event, const Directory::Extension& ext, const Directory::Account& auth) const
+{
+    auto number = ext.number;
+    auto name = ext.name;
+    auto created = auth.created.toString(Qt::ISODate);
+    auto display = ext.display;
+    auto dialing = QString::number(number);
+    if(display.isEmpty())
+        display = auth.fullname;
+    if(display.isEmpty())
+        display = name;
+
+    // operators are special
+    if(number == 0) {
+        if(operatorPolicy == "public")
+            display = "Lobby";
+        else
+            display = "Operators";
+    }
+
+    QString puburi;
+    if(auth.access == "REMOTE")
+        puburi = name + "@" + QString::fromUtf8(Server::sym(CURRENT_NETWORK));
+
+    UString uri = event.uriTo(dialing);
+    return QJsonObject {
+        {"a", name},
+        {"k", QString::fromUtf8(ext.publicKey.toHex())},
+        {"c", created},
+        {"n", number},
+        {"u", QString::fromUtf8(uri)},
+        {"d", display},
+        {"t", auth.type},
+        {"e", auth.email},
+        {"p", puburi},
+    };
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef READER_HPP_
+#define READER_HPP_
+
+#include "../Server/event.hpp"
+#include "statements.hpp"
+#include "directory.hpp"
+#include "request.hpp"
+
+#include <QObject>
+#include <QString>
+#include <QVariantHash>
+#include <QSqlDatabase>
+#include <QSqlRecord>
+#include <QJsonObject>
+#include <QHash>
+
+class Reader final : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(Reader)
+    friend class Database;
+
+public:
+    ~Reader() final;
+
+private:
+    using Entry = struct {
+        quint64 revision;
+        QByteArray json;                // compact roster entry
+    };
+
+    QSqlDatabase db;
+    Statements statements;              // of the reader connection
+    QString name, operatorPolicy, operatorDisplay;
+    QHash<QByteArray, QHash<int, Entry>> rosters;   // by uri form
+    bool failed;
+
+    Reader(unsigned order, int id);
+
+    bool checkConnection();
+    bool resume();
+    void close();
+    void report();
+    QSqlRecord getRecord(const QString& request, const QVariantList &parms = QVariantList());
+    QSqlQuery getRecords(const QString& request, const QVariantList &parms = QVariantList());
+    QJsonObject roster(const Event& ev, const Directory::Extension& ext, const Directory::Account& auth) const;
+    void sendRoster(const Event& ev, qlonglong endpoint);
+    void sendProfile(const Event& ev);
+    void sendPending(const Event& ev, qlonglong endpoint);
+    void sendDeviceList(const Event& ev);
+
+private slots:
+    void activate(const QVariantHash& settings);
+    void query(Request *request);
+};
+
+/*!
+ * Read-only database requests for sipwitch.
+ * \file reader.hpp
+ */
+
+/*!
+ * \class Reader
+ * \brief A read-only database connection in it's own thread.
+ * The database keeps a small pool of readers, each with it's own session,
+ * to build large replies such as rosters, device lists, pending messages,
+ * and profiles, so that these do not hold message inserts and other writes
+ * behind them on the database thread.  Requests are handed to the next
+ * reader by the database thread only after it commits any queued writes,
+ * so a reader always sees every write made before the request.  Anything
+ * a reader needs written is passed back to the database thread.  Sqlite
+ * readers depend on the writer using write-ahead logging.  Requests are
+ * submitted as Request objects, and one that times out while waiting for
+ * a reader is dropped without being queried.
+ *
+ * Rosters are versioned by the directory.  A client that sends the version
+ * of it's last roster in X-Roster gets only the extensions changed since,
+ * along with any pending deletes, and every reply carries the version it
+ * is current to.  Each reader keeps the compact json of unchanged entries
+ * so they are not built again.
+ *
+ * Pending messages are sent in bounded pages in message order.  Each page
+ * carries the X-Cursor of it's last message, and X-More if another follows.
+ * A client acknowledges a page up to that cursor, and sends it back to get
+ * the next page, so an interrupted sync resumes after the last page done.
+ * Messages to an extension, it's groups, or the lobby, are found from their
+ * mailbox above the endpoint's delivery mark, along with it's outbox rows,
+ * so group membership is that at the time pending is asked for.
+ * \author David Sugar <tychosoft@gmail.com>
+ */
+
+#endif
@@ -60,7 +60,7 @@ RequestEvent::~RequestEvent() = default;
 // database receiver processes if(!request->cancelled())
 
 Request::Request(QObject *parent, const Event& sip, int expires) :
-QObject(parent), status(Success), sipEvent(sip), signalled(false)
+QObject(parent), status(Success), sipEvent(sip), readKind(Query), readEndpoint(-1), deadline(expires), signalled(false)
 {
     // compute propogation delay...
     expires -= sip.elapsed() - 20;
@@ -70,7 +70,7 @@ QObject(parent), status(Success), sipEvent(sip), signalled(false)
 }
 
 Request::Request(QObject *parent, const Event& sip, int expires, Reply method) :
-QObject(parent), status(Success), sipEvent(sip), signalled(false)
+QObject(parent), status(Success), sipEvent(sip), readKind(Query), readEndpoint(-1), deadline(expires), signalled(false)
 {
     connect(this, &Request::results, parent, method);
 
@@ -82,6 +82,32 @@ QObject(parent), status(Success), sipEvent(sip), signalled(false)
         QTimer::singleShot(expires, Qt::CoarseTimer, this, &Request::timeout);
 }
 
+// emit Database::submit(new Request(this, event, "SELECT ...", {parms}))
+// with results connected to the requestor, ideally before it is submitted
+
+Request::Request(QObject *parent, const Event& sip, const QString& query, const QVariantList& parms, int expires) :
+QObject(parent), status(Success), sipEvent(sip), sqlQuery(query), sqlParms(parms), readKind(Query), readEndpoint(-1), deadline(expires), signalled(false)
+{
+    // compute propogation delay...
+    expires -= sip.elapsed() - 20;
+    if(expires < 10)
+        expires = 10;
+    QTimer::singleShot(expires, Qt::CoarseTimer, this, &Request::timeout);
+}
+
+// Database::submit(new Request(this, event, Request::Roster, endpoint))
+// where the reader answers the event, and results only report that it did
+
+Request::Request(QObject *parent, const Event& sip, Reading read, qlonglong endpoint, int expires) :
+QObject(parent), status(Success), sipEvent(sip), readKind(read), readEndpoint(endpoint), deadline(expires), signalled(false)
+{
+    // compute propogation delay...
+    expires -= sip.elapsed() - 20;
+    if(expires < 10)
+        expires = 10;
+    QTimer::singleShot(expires, Qt::CoarseTimer, this, &Request::timeout);
+}
+
 void Request::timeout()
 {
     if(!signalled) {
@@ -138,3 +164,9 @@ void Request::notifyFailed(ErrorResult error)
         new RequestEvent(REQUEST_FAILED, error));
 }
 
+void Request::notifyAnswered()
+{
+    QCoreApplication::postEvent(this,
+        new RequestEvent(REQUEST_SUCCESS, Immediate));
+}
+
@@ -42,27 +42,69 @@ public:
         Immediate,          // immediate result returned (same as success)
     };
 
+    enum Reading {
+        Query = 0,          // records of it's own sql query
+        Roster,             // answered by a reader...
+        Profile,
+        Devlist,
+        Pending,
+    };
+
     using Reply = void(&)(ErrorResult, const Event&, const QList<QSqlRecord>&);
 
+    static const int Transaction = 32000;   // sip non-invite timeout, 64*T1
+
     Request(QObject *parent, const Event& sip, int expires);
     Request(QObject *parent, const Event& sip, int expires, Reply method);
+    Request(QObject *parent, const Event& sip, const QString& query, const QVariantList& parms = QVariantList(), int expires = Transaction);
+    Request(QObject *parent, const Event& sip, Reading read, qlonglong endpoint = -1, int expires = Transaction);
 
     const Event& event() const {
         return sipEvent;
     }
 
+    const QString& query() const {
+        return sqlQuery;
+    }
+
+    const QVariantList& parms() const {
+        return sqlParms;
+    }
+
+    Reading reading() const {
+        return readKind;
+    }
+
+    qlonglong endpoint() const {
+        return readEndpoint;
+    }
+
     inline bool isSignalled() {
         return signalled;
     }
 
+    inline bool isExpired() const {
+        return signalled || sipEvent.elapsed() >= deadline;
+    }
+
+    inline static bool isExpired(const Event& sip) {
+        return sip.elapsed() >= Transaction;
+    }
+
     bool cancelled();
 
     void notifySuccess(QSqlQuery &results, ErrorResult error = Success);
     void notifyFailed(ErrorResult error = DbFailed);
+    void notifyAnswered();
 
 private:
     ErrorResult status;
     Event sipEvent;
+    QString sqlQuery;
+    QVariantList sqlParms;
+    Reading readKind;
+    qlonglong readEndpoint;
+    qint64 deadline;                // on the sip event's elapsed clock
     volatile bool signalled;
 
     bool event(QEvent *evt) final;
@@ -97,7 +139,33 @@ private slots:
  * database engine.  It is also possible to create derived request objects,
  * and I do this in sipwitch to modularize & isolate the queries and db
  * handling code for simpler maintainability.
+ *
+ * A request may also carry it's own query, to be run by Database::submit().
+ * A request is due by the deadline of the sip transaction it answers, and
+ * one that is no longer wanted, either because it timed out in it's own
+ * thread or because it's deadline passed while queued, is dropped by the
+ * database thread before it's query is run.
+ *
+ * Submitted requests are run by a database reader once any queued writes
+ * are committed, and are checked again for their deadline when the reader
+ * takes them.  A request may instead ask a reader to answer it's sip event
+ * directly, such as with a roster or a page of pending messages, and then
+ * only reports back to the requestor that it was answered.
  * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Request::Request(QObject *parent, const Event& sip, const QString& query, const QVariantList& parms, int expires)
+ * \param parent Object in the requesting thread, results are signalled there.
+ * \param sip Event being answered.
+ * \param query Sql query to run.
+ * \param parms Values bound to the query.
+ * \param expires Milliseconds from when the event was received.
+ *
+ * \fn Request::Request(QObject *parent, const Event& sip, Reading read, qlonglong endpoint, int expires)
+ * \param parent Object in the requesting thread, results are signalled there.
+ * \param sip Event to be answered by a reader.
+ * \param read Kind of answer to build.
+ * \param endpoint Endpoint of the requestor, if the answer needs it.
+ * \param expires Milliseconds from when the event was received.
  */
 
 #endif
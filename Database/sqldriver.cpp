@@ -77,6 +77,8 @@ static QStringList sqliteTables = {
         "created DATETIME DEFAULT CURRENT_TIMESTAMP,"
         "lastaccess DATETIME DEFAULT 0,"
         "lasturi VARCHAR(96),"
+        "delivered INTEGER DEFAULT 0,"          // messages delivered thru
+        "sent INTEGER DEFAULT 0,"               // messages in last pending
         "CONSTRAINT registryIndex UNIQUE (extnbr, label),"
         "FOREIGN KEY (extnbr) REFERENCES Extensions(extnbr) "
             "ON DELETE CASCADE);",
@@ -145,7 +147,12 @@ static QStringList sqliteTables = {
         "posted TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
         "expires TIMESTAMP,"                    // estimated expiration
         "msgtype VARCHAR(8),"
-        "msgtext TEXT);",
+        "msgtext TEXT,"
+        "mailbox INTEGER DEFAULT NULL,"         // extension or group delivered
+        "origin INTEGER DEFAULT NULL);",        // sender's devices synced
+
+    "CREATE INDEX messagePosted ON Messages(posted);",        // retention
+    "CREATE INDEX messageMailbox ON Messages(mailbox, mid);", // pending
 
     "CREATE TABLE Outboxes ("
         "mid INTEGER,"
@@ -156,10 +163,12 @@ static QStringList sqliteTables = {
             "ON DELETE CASCADE,"
         "FOREIGN KEY (endpoint) REFERENCES Endpoints(endpoint) "
             "ON DELETE CASCADE);",
+
+    "CREATE INDEX outboxMessage ON Outboxes(mid);",           // retention
 };
 
 static QStringList sqlitePragmas = {
-    "PRAGMA locking_mode = EXCLUSIVE;",
+    "PRAGMA journal_mode = WAL;",         // so readers have their own sessions
     "PRAGMA synchronous = OFF;",
     "PRAGMA temp_store = MEMORY;",
 };
@@ -47,6 +47,8 @@ CREATE TABLE Endpoints (
     created DATETIME DEFAULT CURRENT_TIMESTAMP,
     lastaccess DATETIME DEFAULT 0,
     lasturi VARCHAR(96),
+    delivered INTEGER DEFAULT 0,           -- messages delivered thru
+    sent INTEGER DEFAULT 0,                -- messages in last pending
     CONSTRAINT registryIndex UNIQUE (extnbr, label), 
     FOREIGN KEY (extnbr) REFERENCES Extensions(extnbr)
         ON DELETE CASCADE);
@@ -107,7 +109,12 @@ CREATE TABLE Messages (
     posted TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
     expires TIMESTAMP,                    -- estimated expiration
     msgtype VARCHAR(8),
-    msgtext TEXT);
+    msgtext TEXT,
+    mailbox INTEGER DEFAULT NULL,         -- extension or group delivered
+    origin INTEGER DEFAULT NULL);         -- sender's devices synced
+
+CREATE INDEX messagePosted ON Messages(posted);           -- retention
+CREATE INDEX messageMailbox ON Messages(mailbox, mid);    -- pending
 
 CREATE TABLE Deletes (
     authname VARCHAR(32),
@@ -127,3 +134,5 @@ CREATE TABLE Outboxes (
     FOREIGN KEY (endpoint) REFERENCES Endpoints(endpoint)
         ON DELETE CASCADE);
 
+CREATE INDEX outboxMessage ON Outboxes(mid);              -- retention
+
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "statements.hpp"
+
+Statements::Statements(int size) :
+limit(size), hits(0), misses(0)
+{
+}
+
+QSqlQuery Statements::prepare(const QSqlDatabase& db, const QString& request)
+{
+    auto entry = cache.find(request);
+    if(entry != cache.end()) {
+        recent.removeOne(request);
+        recent << request;
+
+        // a result set still being read belongs to it's reader...
+        if(!entry->isActive() || entry->at() == QSql::AfterLastRow) {
+            ++hits;
+            entry->finish();
+            return *entry;
+        }
+        cache.erase(entry);
+    }
+    else
+        recent << request;
+
+    ++misses;
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if(!query.prepare(request)) {
+        recent.removeOne(request);
+        return query;
+    }
+
+    cache.insert(request, query);
+    while(recent.count() > limit)
+        cache.remove(recent.takeFirst());
+    return query;
+}
+
+void Statements::clear()
+{
+    cache.clear();
+    recent.clear();
+}
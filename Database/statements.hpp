@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATEMENTS_HPP_
+#define STATEMENTS_HPP_
+
+#include "../Common/compiler.hpp"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QHash>
+#include <QList>
+
+class Statements final
+{
+    Q_DISABLE_COPY(Statements)
+
+public:
+    using Stats = struct {
+        quint64 hits, misses;
+        unsigned size;
+    };
+
+    explicit Statements(int limit = 64);
+
+    inline const Stats stats() const {
+        return {hits, misses, static_cast<unsigned>(cache.count())};
+    }
+
+    QSqlQuery prepare(const QSqlDatabase& db, const QString& request);
+    void clear();
+
+private:
+    QHash<QString, QSqlQuery> cache;
+    QList<QString> recent;              // least recently used first
+    int limit;
+    quint64 hits, misses;
+};
+
+/*!
+ * Prepared statement cache for database connections.
+ * \file statements.hpp
+ */
+
+/*!
+ * \class Statements
+ * \brief Prepared statements of one database connection.
+ * Queries are prepared forward-only once, and kept by their sql text so
+ * that repeated requests skip parsing and planning.  A cached statement
+ * whose result set is still being read, such as from an outer loop over
+ * the same request, is never re-executed underneath it's reader; a fresh
+ * statement is prepared to replace it instead.  The least recently used
+ * statement is dropped past the limit.  A cache must be cleared whenever
+ * it's connection is closed.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Statements::prepare(const QSqlDatabase& db, const QString& request)
+ * \param db Connection the cache belongs to.
+ * \param request Sql text of the query.
+ * \return prepared query, inactive if it could not be prepared.
+ */
+
+#endif
@@ -1471,7 +1471,9 @@ void Phonebook::changeStatus(const QByteArray& status, int first, int last)
     unsigned pos = 0, mask = 1;
     auto count = first;
     auto *cp = reinterpret_cast<const unsigned char *>(status.constData());
-    while(count < last) {
+    if(last > 1000)     // phonebook only tracks 3 digit plans
+        last = 1000;
+    while(count < last && pos < static_cast<unsigned>(status.size())) {
         auto online = (cp[pos] & mask) != 0;
         if(localModel)
             localModel->changeOnline(count, online);
@@ -1060,7 +1060,9 @@ void Sessions::changeConnector(Connector *connected)
                     storage->runQuery("UPDATE Contacts SET last=?, sequence=? WHERE uid=?;",
                         {session->mostRecent, session->lastSequence, uid});
             }
-            connector->ackPending();    // let server know we processed...
+            // let server know we processed, and get the next page...
+            if(connector->ackPending())
+                connector->requestPending();
         }, Qt::QueuedConnection);
 
     }
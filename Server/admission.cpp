@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "admission.hpp"
+
+#include <QDebug>
+#include <atomic>
+#include <cstring>
+
+#define ADMISSION_SOURCES 100   // default requests per second from an address...
+#define ADMISSION_EXTENSIONS 20 // default requests per second from an extension...
+#define ADMISSION_BURST 2       // default seconds of rate a bucket may save...
+#define ADMISSION_TRACKED 4096  // default buckets held of each kind...
+#define ADMISSION_TOKEN 1000    // bucket units of one request...
+
+// rates are in requests per second, or bucket units per msec
+namespace {
+std::atomic<unsigned> rates[Admission::KINDS] = {{ADMISSION_SOURCES}, {ADMISSION_EXTENSIONS}};
+std::atomic<unsigned> burst(ADMISSION_BURST);
+std::atomic<int> tracked(ADMISSION_TRACKED);
+std::atomic<quint64> totals[Admission::KINDS];
+
+const unsigned defaults[Admission::KINDS] = {ADMISSION_SOURCES, ADMISSION_EXTENSIONS};
+const char *keys[Admission::KINDS] = {
+    "admission/sources", "admission/extensions",
+};
+} // namespace
+
+Admission::Admission() :
+sources(ADMISSION_TRACKED), extensions(ADMISSION_TRACKED)
+{
+    memset(counts, 0, sizeof(counts));
+    clock.start();
+}
+
+void Admission::configure(const QVariantHash& config)
+{
+    for(unsigned kind = 0; kind < KINDS; ++kind) {
+        auto value = config.value(keys[kind]);
+        rates[kind].store(value.isValid() ? value.toUInt() : defaults[kind]);
+    }
+
+    auto seconds = config.value("admission/burst", ADMISSION_BURST).toUInt();
+    burst.store(seconds ? seconds : 1);
+
+    auto limit = config.value("admission/tracked", ADMISSION_TRACKED).toInt();
+    tracked.store(limit > 0 ? limit : 1);
+}
+
+quint64 Admission::dropped(Kind kind)
+{
+    Q_ASSERT(kind < KINDS);
+    return totals[kind].load();
+}
+
+const Admission::Stats Admission::stats(Kind kind) const
+{
+    Q_ASSERT(kind < KINDS);
+    auto stats = counts[kind];
+    stats.tracked = static_cast<unsigned>(kind == SOURCE ? sources.size() : extensions.size());
+    return stats;
+}
+
+template<typename Key>
+int Admission::admit(QCache<Key, Bucket>& cache, const Key& key, Kind kind)
+{
+    auto rate = static_cast<qint64>(rates[kind].load());
+    if(!rate)
+        return 0;
+
+    auto limit = tracked.load();
+    if(cache.maxCost() != limit)
+        cache.setMaxCost(limit);
+
+    // a bucket not tracked, or pushed out of the cache, starts full
+    auto now = clock.elapsed();
+    auto full = rate * burst.load() * ADMISSION_TOKEN;
+    auto bucket = cache.object(key);
+    if(!bucket) {
+        bucket = new Bucket{full, now, false};
+        cache.insert(key, bucket);
+    }
+    else {
+        bucket->tokens += (now - bucket->updated) * rate;
+        if(bucket->tokens > full)
+            bucket->tokens = full;
+        bucket->updated = now;
+    }
+
+    if(bucket->tokens >= ADMISSION_TOKEN) {
+        bucket->tokens -= ADMISSION_TOKEN;
+        bucket->limited = false;
+        ++counts[kind].admitted;
+        return 0;
+    }
+
+    if(!bucket->limited) {
+        bucket->limited = true;
+        qDebug() << "Throttling" << (kind == SOURCE ? "source" : "extension") << key;
+    }
+
+    ++counts[kind].dropped;
+    totals[kind].fetch_add(1);
+    auto wait = (ADMISSION_TOKEN - bucket->tokens) / rate;
+    return static_cast<int>(wait / 1000) + 1;
+}
+
+int Admission::source(const UString& host)
+{
+    return admit(sources, host, SOURCE);
+}
+
+int Admission::extension(int number, const UString& host)
+{
+    if(number < 1)
+        return 0;
+    return admit(extensions, UString::number(number) + "@" + host, EXTENSION);
+}
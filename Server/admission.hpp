@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ADMISSION_HPP_
+#define ADMISSION_HPP_
+
+#include "../Common/compiler.hpp"
+#include "../Common/types.hpp"
+
+#include <QVariantHash>
+#include <QElapsedTimer>
+#include <QCache>
+
+class Admission final
+{
+    Q_DISABLE_COPY(Admission)
+
+public:
+    enum Kind : unsigned {
+        SOURCE, EXTENSION, KINDS,
+    };
+
+    using Stats = struct {
+        quint64 admitted, dropped;
+        unsigned tracked;               // buckets held now
+    };
+
+    Admission();
+
+    int source(const UString& host);
+    int extension(int number, const UString& host);
+    const Stats stats(Kind kind) const;
+
+    static void configure(const QVariantHash& config);
+    static quint64 dropped(Kind kind);
+
+private:
+    using Bucket = struct {
+        qint64 tokens;                  // in thousandths of a request
+        qint64 updated;                 // on admission clock
+        bool limited;                   // dropping since last admitted
+    };
+
+    QElapsedTimer clock;
+    QCache<UString, Bucket> sources;
+    QCache<UString, Bucket> extensions; // by extension and source
+    Stats counts[KINDS];
+
+    template<typename Key>
+    int admit(QCache<Key, Bucket>& cache, const Key& key, Kind kind);
+};
+
+/*!
+ * Per source admission control for new requests.
+ * \file admission.hpp
+ */
+
+/*!
+ * \class Admission
+ * \brief Token buckets of the sources and extensions seen by a context.
+ * Each context checks new requests against a token bucket for the address
+ * they came from, as the stack marks it in the top via, and another for
+ * the local extension they are from at that address, before anything else
+ * is done with them.  Requests are not yet authenticated when checked, so a
+ * request forging another extension's number only spends a bucket of it's
+ * own source, and cannot lock the real extension out.  A source or
+ * extension sending faster than it's configured rate, once it's saved
+ * burst is spent, is answered 503 directly from the context, so that a
+ * single misbehaving device or scanner is turned away cheaply rather than
+ * flooding the stack and database with requests that will be rejected
+ * anyway.  Buckets are held in a least recently used cache bounded by the
+ * tracked limit, so a scan from many addresses costs no more than that,
+ * and a bucket dropped from the cache simply starts again full.  Each
+ * context keeps it's own buckets, used only from it's own thread, so no
+ * locking is needed.  Where a source is spread over sibling workers, it may
+ * be admitted at up to that many times the rate.  Counts of dropped
+ * requests are kept for each context and in total, and reported by the
+ * contexts periodically.  Rates are set in the [admission] config section,
+ * and a rate of zero admits everything of that kind.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Admission::source(const UString& host)
+ * \param host Address a new request came from.
+ * \return seconds to retry after if dropped, else 0.
+ *
+ * \fn Admission::extension(int number, const UString& host)
+ * \param number Local extension a new request is from.
+ * \param host Address the request came from.
+ * \return seconds to retry after if dropped, else 0.
+ */
+
+#endif
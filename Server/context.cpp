@@ -18,6 +18,7 @@
 #include "server.hpp"
 #include "output.hpp"
 #include "manager.hpp"
+#include "overload.hpp"
 
 #include <QNetworkInterface>
 #include <QJsonDocument>
@@ -30,52 +31,22 @@
 #include <unistd.h>
 #endif
 
-#define EVENT_TIMER 500l    // 500ms...
-
-#define MSG_IS_ROSTER(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method,"X-ROSTER"))
-
-#define MSG_IS_PROFILE(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-PROFILE"))
-
-#define MSG_IS_COVERAGE(msg)  (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-COVERAGE"))
-
-#define MSG_IS_FORWARDING(msg)  (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-FORWARDING"))
-
-#define MSG_IS_MEMBERSHIP(msg)  (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-MEMBERSHIP"))
-
-#define MSG_IS_TOPIC(msg)  (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-TOPIC"))
-
-#define MSG_IS_DEVLIST(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method,"X-DEVLIST"))
-
-#define MSG_IS_DEVKILL(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method,"X-DEVKILL"))
-
-#define MSG_IS_PENDING(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-PENDING"))
-
-#define MSG_IS_AUTHORIZE(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-AUTHORIZE"))
-
-#define MSG_IS_DEAUTHORIZE(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-DEAUTHORIZE"))
-
-#define MSG_IS_ACK_PENDING(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "A-PENDING"))
+#if defined(Q_OS_LINUX)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#define EVENT_DRIVEN
+#endif
 
-#define MSG_IS_ADMIN(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-ADMIN"))
+#include <cstring>
 
-#define MSG_IS_DROP(msg)   (MSG_IS_REQUEST(msg) && \
-    0==strcmp((msg)->sip_method, "X-DROP"))
+#define EVENT_TIMER 500l    // 500ms...
+#define ACTION_TIMER 1000l  // automatic actions once a second...
+#define REPORT_TIMER 60000l // admission drops reported once a minute...
 
 namespace {
 bool active = true;
+int shutdownFd = -1;
 
 // internal lock class
 class ContextLocker final
@@ -94,6 +65,160 @@ public:
 private:
     eXosip_t *context;
 };
+
+// preconditions an extension method may require of a request
+enum Policy : unsigned {
+    NUMBERED =  1 << 0,     // from a local extension number
+    LABELED =   1 << 1,     // from a labeled (sipwitchqt) client
+    TO_USER =   1 << 2,     // has a to user
+    TO_LOCAL =  1 << 3,     // to user is local
+    CRITICAL =  1 << 4,     // never shed or throttled by extension
+    TO_FIRST =  1 << 5,     // to user checked first, unnumbered is 403
+};
+
+using Method = struct {
+    const char *name;
+    unsigned policy;
+    unsigned transports;    // context protocols allowed
+    const char *content;    // content type of body, if any
+    int minBody, maxBody;   // body size limits, -1 if unlimited
+    void (Context::*signal)(const Event&);
+    Manager::Action action; // once authenticated
+    Scheduler::Class priority;
+};
+
+const unsigned STREAMS = Context::TCP | Context::TLS;
+const unsigned ANY_TRANSPORT = Context::UDP | Context::TCP | Context::TLS | Context::DTLS;
+const unsigned TARGETED = NUMBERED | LABELED | TO_USER | TO_LOCAL;
+
+constexpr Method methods[] = {
+    {"X-ROSTER",        NUMBERED | LABELED, STREAMS, nullptr, 0, -1, &Context::REQUEST_ROSTER, Manager::ROSTER, Scheduler::CONTROL},
+    {"X-PROFILE",       TARGETED | TO_FIRST, STREAMS, "profile/json", 0, -1, &Context::REQUEST_PROFILE, Manager::PROFILE, Scheduler::CONTROL},
+    {"X-COVERAGE",      TARGETED | TO_FIRST, STREAMS, nullptr, 0, -1, &Context::REQUEST_COVERAGE, Manager::COVERAGE, Scheduler::CONTROL},
+    {"X-FORWARDING",    TARGETED | TO_FIRST, STREAMS, nullptr, 0, -1, &Context::REQUEST_FORWARDING, Manager::FORWARDING, Scheduler::CONTROL},
+    {"X-ADMIN",         TARGETED | TO_FIRST, STREAMS, nullptr, 0, 0, &Context::REQUEST_ADMIN, Manager::ADMIN, Scheduler::CONTROL},
+    {"X-DROP",          TARGETED | TO_FIRST, STREAMS, nullptr, 0, 0, &Context::REQUEST_DROP, Manager::DROP, Scheduler::CONTROL},
+    {"X-MEMBERSHIP",    TARGETED | TO_FIRST, STREAMS, nullptr, 0, 0, &Context::REQUEST_MEMBERSHIP, Manager::MEMBERSHIP, Scheduler::CONTROL},
+    {"X-TOPIC",         TARGETED | TO_FIRST, STREAMS, nullptr, 0, -1, &Context::REQUEST_TOPIC, Manager::TOPIC, Scheduler::CONTROL},
+    {"X-DEVLIST",       NUMBERED | LABELED, STREAMS, nullptr, 0, -1, &Context::REQUEST_DEVLIST, Manager::DEVLIST, Scheduler::CONTROL},
+    {"X-DEVKILL",       NUMBERED | LABELED, STREAMS, nullptr, 0, -1, &Context::REQUEST_DEVKILL, Manager::DEVKILL, Scheduler::CONTROL},
+    {"X-DEAUTHORIZE",   TARGETED, STREAMS, nullptr, 0, -1, &Context::REQUEST_DEAUTHORIZE, Manager::DEAUTHORIZE, Scheduler::CONTROL},
+    {"X-AUTHORIZE",     TARGETED, STREAMS, "authorize/json", 1, -1, &Context::REQUEST_AUTHORIZE, Manager::AUTHORIZE, Scheduler::CONTROL},
+    {"X-PENDING",       NUMBERED | LABELED, STREAMS, nullptr, 0, -1, &Context::REQUEST_PENDING, Manager::PENDING, Scheduler::MESSAGING},
+    {"A-PENDING",       NUMBERED | LABELED | CRITICAL, ANY_TRANSPORT, nullptr, 0, -1, &Context::ACK_PENDING, Manager::ACK_PENDING, Scheduler::MESSAGING},
+};
+
+// fnv-1a, usable in constant expressions
+constexpr unsigned methodHash(const char *cp, unsigned hash = 2166136261u)
+{
+    return *cp ? methodHash(cp + 1, (hash ^ static_cast<unsigned char>(*cp)) * 16777619u) : hash;
+}
+
+constexpr unsigned METHOD_SLOTS = 97;
+constexpr unsigned METHOD_COUNT = sizeof(methods) / sizeof(Method);
+
+constexpr bool uniqueSlot(unsigned pos, unsigned other)
+{
+    return other >= METHOD_COUNT || ((methodHash(methods[pos].name) % METHOD_SLOTS != methodHash(methods[other].name) % METHOD_SLOTS) && uniqueSlot(pos, other + 1));
+}
+
+constexpr bool perfectHash(unsigned pos = 0)
+{
+    return pos >= METHOD_COUNT || (uniqueSlot(pos, pos + 1) && perfectHash(pos + 1));
+}
+
+static_assert(perfectHash(), "extension method hash collides, change METHOD_SLOTS");
+
+// extension methods found by a single slot lookup
+class MethodIndex final
+{
+public:
+    MethodIndex() {
+        memset(slots, 0, sizeof(slots));
+        for(unsigned pos = 0; pos < METHOD_COUNT; ++pos)
+            slots[methodHash(methods[pos].name) % METHOD_SLOTS] = &methods[pos];
+    }
+
+    inline const Method *find(const char *name) const {
+        if(!name)
+            return nullptr;
+        auto method = slots[methodHash(name) % METHOD_SLOTS];
+        if(!method || strcmp(method->name, name))
+            return nullptr;
+        return method;
+    }
+
+private:
+    const Method *slots[METHOD_SLOTS];
+};
+
+const MethodIndex methodIndex;
+
+// address the stack received a request from, as it marks the top via,
+// rather than the sender's own vias, which may be forged...
+UString peer(const Event& ev)
+{
+    auto msg = ev.message();
+    auto via = msg ? static_cast<osip_via_t *>(osip_list_get(&msg->vias, 0)) : nullptr;
+    if(!via || !via->host)
+        return ev.source().host();
+
+    osip_generic_param_t *param = nullptr;
+    osip_via_param_get_byname(via, const_cast<char *>("received"), &param);
+    if(param && param->gvalue)
+        return param->gvalue;
+    return via->host;
+}
+
+// sip result for the to user a policy requires
+int target(const Event& ev, unsigned policy)
+{
+    if(policy & TO_USER) {
+        auto to = ev.message()->to;
+        if(!to || !to->url || !to->url->username)
+            return SIP_ADDRESS_INCOMPLETE;
+    }
+
+    if((policy & TO_LOCAL) && !ev.toLocal())
+        return SIP_FORBIDDEN;
+
+    return SIP_OK;
+}
+
+// sip result for a request checked against method policy
+int permit(const Event& ev, const Method *method, unsigned proto)
+{
+    auto policy = method->policy;
+
+    // some check where a request goes before who sent it...
+    if(policy & TO_FIRST) {
+        auto result = target(ev, policy);
+        if(result != SIP_OK)
+            return result;
+        if((policy & NUMBERED) && ev.number() < 1)
+            return SIP_FORBIDDEN;
+        policy &= ~(NUMBERED | TO_USER | TO_LOCAL);
+    }
+
+    if(!(method->transports & proto))
+        return SIP_METHOD_NOT_ALLOWED;
+    if((policy & NUMBERED) && ev.number() < 1)
+        return SIP_METHOD_NOT_ALLOWED;
+    if((policy & LABELED) && ev.label() == "NONE")
+        return SIP_METHOD_NOT_ALLOWED;
+
+    auto result = target(ev, policy);
+    if(result != SIP_OK)
+        return result;
+
+    auto size = ev.body().size();
+    if(size < method->minBody || (method->maxBody > -1 && size > method->maxBody))
+        return SIP_NOT_ACCEPTABLE_HERE;
+    if(method->content && size > 0 && ev.contentType() != method->content)
+        return SIP_NOT_ACCEPTABLE_HERE;
+
+    return SIP_OK;
+}
 } // anon namespace
 
 volatile unsigned Context::instanceCount = 0;
@@ -120,8 +245,8 @@ void Context::dump(const osip_message_t *msg)
     }
 }
 
-Context::Context(const QHostAddress& addr, quint16 port, const Schema& choice, unsigned mask, unsigned index):
-schema(choice), context(nullptr), currentEvent(0), priorEvent(0), netFamily(AF_INET), netPort(port)
+Context::Context(const QHostAddress& addr, quint16 port, const Schema& choice, unsigned mask, unsigned index, unsigned worker, unsigned workers):
+schema(choice), context(nullptr), eventPool(nullptr), eventFd(-1), pollFd(-1), actionDeadline(0), reportDeadline(0), reportedDrops(0), netFamily(AF_INET), netPort(port), netIndex(index), netWorker(worker), netWorkers(workers), netBind(addr)
 {
     allow = mask & 0xffffff00;
     netPort &= 0xfffe;
@@ -148,7 +273,18 @@ schema(choice), context(nullptr), currentEvent(0), priorEvent(0), netFamily(AF_I
     if(!addr.isNull())
         netAddress = addr.toString().toUtf8();
 
-    setObjectName(QString("sip") + QString::number(index) + "/" + choice.name);
+#ifdef EVENT_DRIVEN
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+#ifdef EVENT_TIMING
+    memset(timing, 0, sizeof(timing));
+#endif
+    eventPool = new EventPool(Event::dataSize());
+
+    if(workers > 1)
+        setObjectName(QString("sip") + QString::number(index) + "/" + choice.name + "." + QString::number(worker));
+    else
+        setObjectName(QString("sip") + QString::number(index) + "/" + choice.name);
     Contexts << this;
 
     if(addr != QHostAddress::Any && addr != QHostAddress::AnyIPv4 && addr != QHostAddress::AnyIPv6) {
@@ -184,6 +320,14 @@ Context::~Context()
 {
     if(context)
         eXosip_quit(context);
+
+    // pool is released when last pooled event also goes away
+    eventPool->close();
+
+#ifdef EVENT_DRIVEN
+    if(eventFd > -1)
+        ::close(eventFd);
+#endif
 }
 
 const UString Context::uriTo(const Contact &address) const
@@ -202,6 +346,25 @@ const UString Context::uriTo(const Contact &address) const
     return schema.uri + host + port;
 }
 
+bool Context::isReusable()
+{
+#ifdef SO_REUSEPORT
+    return true;
+#else
+    return false;
+#endif
+}
+
+const QList<Context *> Context::siblings() const
+{
+    QList<Context *> list;
+    foreach(auto context, Contexts) {
+        if(isSibling(context))
+            list << context;
+    }
+    return list;
+}
+
 QAbstractSocket::NetworkLayerProtocol Context::protocol()
 {
     if(netFamily == AF_INET)
@@ -218,68 +381,89 @@ void Context::run()
     auto stack = Manager::instance();
     auto database = Database::instance();
 
+    auto priority = stack->queues();
     if(allow & Allow::REGISTRY)
-        connect(this, &Context::REQUEST_REGISTER, stack, &Manager::refreshRegistration);
+        priority->route(this, &Context::REQUEST_REGISTER, stack, &Manager::refreshRegistration, Scheduler::REGISTRATION);
 
     if(netProto == IPPROTO_TCP) {
-        connect(this, &Context::REQUEST_ROSTER, stack, &Manager::requestRoster);
-        connect(this, &Context::REQUEST_PROFILE, stack, &Manager::requestProfile);
-        connect(this, &Context::REQUEST_DEVLIST, stack, &Manager::requestDevlist);
-        connect(this, &Context::REQUEST_PENDING, stack, &Manager::requestPending);
-        connect(this, &Context::REQUEST_AUTHORIZE, stack, &Manager::requestAuthorize);
-        connect(this, &Context::REQUEST_DEAUTHORIZE, stack, &Manager::requestDeauthorize);
-        connect(this, &Context::REQUEST_MEMBERSHIP, stack, &Manager::requestMembership);
-        connect(this, &Context::REQUEST_FORWARDING, stack, &Manager::requestForwarding);
-        connect(this, &Context::REQUEST_ADMIN, stack, &Manager::requestAdmin);
-        connect(this, &Context::REQUEST_DROP, stack, &Manager::requestDrop);
-        connect(this, &Context::REQUEST_COVERAGE, stack, &Manager::requestCoverage);
-        connect(this, &Context::REQUEST_TOPIC, stack, &Manager::requestTopic);
-        connect(this, &Context::ACK_PENDING, stack, &Manager::ackPending);
-        connect(this, &Context::REQUEST_DEVKILL, stack, &Manager::requestDevkill);
-    }
-
-    connect(this, &Context::LOCAL_MESSAGE, database, &Database::localMessage);
-    connect(this, &Context::MESSAGE_RESPONSE, database, &Database::messageResponse);
-
-    debug() << "Running " << objectName();
+        priority->route(this, &Context::REQUEST_ROSTER, stack, &Manager::requestRoster, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_PROFILE, stack, &Manager::requestProfile, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_DEVLIST, stack, &Manager::requestDevlist, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_PENDING, stack, &Manager::requestPending, Scheduler::MESSAGING);
+        priority->route(this, &Context::REQUEST_AUTHORIZE, stack, &Manager::requestAuthorize, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_DEAUTHORIZE, stack, &Manager::requestDeauthorize, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_MEMBERSHIP, stack, &Manager::requestMembership, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_FORWARDING, stack, &Manager::requestForwarding, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_ADMIN, stack, &Manager::requestAdmin, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_DROP, stack, &Manager::requestDrop, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_COVERAGE, stack, &Manager::requestCoverage, Scheduler::CONTROL);
+        priority->route(this, &Context::REQUEST_TOPIC, stack, &Manager::requestTopic, Scheduler::CONTROL);
+        priority->route(this, &Context::ACK_PENDING, stack, &Manager::ackPending, Scheduler::MESSAGING);
+        priority->route(this, &Context::REQUEST_DEVKILL, stack, &Manager::requestDevkill, Scheduler::CONTROL);
+    }
 
-    const char *ap = nullptr;
+    database->queues()->route(this, &Context::LOCAL_MESSAGE, database, &Database::localMessage, Scheduler::MESSAGING);
+    database->queues()->route(this, &Context::MESSAGE_RESPONSE, database, &Database::messageResponse, Scheduler::MESSAGING);
+    priority->route(this, &Context::MESSAGE_RESPONSE, stack, &Manager::messageResponse, Scheduler::MESSAGING);
 
-    if(!netAddress.isEmpty()) {
-        ap = netAddress.constData();
-    }
-    else if(netAddress == "0.0.0.0")
-        ap = nullptr;
+    debug() << "Running " << objectName();
 
-    priorEvent = 0;
-    
-    //qDebug() << "LISTEN " << proto << ap << port << family << NetTLS;
-    if(eXosip_listen_addr(context, netProto, ap, netPort, netFamily, netTLS)) {
+    if(!listen()) {
         error() << objectName() << ": failed to bind and listen";
         context = nullptr;
     }
 
-    while(active && context) {
-        int s = EVENT_TIMER / 1000l;
-        int ms = EVENT_TIMER % 1000l;
-        Event event(eXosip_event_wait(context, s, ms), this);
+#ifdef EVENT_DRIVEN
+    if(context && eventFd > -1)
+        pollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(pollFd > -1) {
+        struct epoll_event watch;
+        memset(&watch, 0, sizeof(watch));
+        watch.events = EPOLLIN;
+        watch.data.fd = eXosip_event_geteventsocket(context);
+        epoll_ctl(pollFd, EPOLL_CTL_ADD, watch.data.fd, &watch);
+        // we drain the exosip wakeup pipe ourselves, without blocking
+        ::fcntl(watch.data.fd, F_SETFL, ::fcntl(watch.data.fd, F_GETFL) | O_NONBLOCK);
+        watch.data.fd = eventFd;
+        epoll_ctl(pollFd, EPOLL_CTL_ADD, eventFd, &watch);
+        if(shutdownFd > -1) {
+            watch.data.fd = shutdownFd;
+            epoll_ctl(pollFd, EPOLL_CTL_ADD, shutdownFd, &watch);
+        }
+    }
+    else if(context)
+        warning() << objectName() << ": no epoll, polling events";
+#endif
 
-        time(&currentEvent);
+    actionTimer.start();
+    actionDeadline = 0;
+    reportDeadline = REPORT_TIMER;
 
-        if(!event) {
-            priorEvent = currentEvent;
+    while(active && context) {
+        // automatic actions run from a deadline, even under high load
+        auto now = actionTimer.elapsed();
+        if(now >= actionDeadline) {
+            actionDeadline = now + ACTION_TIMER;
             ContextLocker lock(context);    // scope lock automatic block...
             eXosip_automatic_action(context);
-            continue;
         }
-
-        // make sure even on high load we call automatic ops once a second
-        if(currentEvent != priorEvent) {
-            priorEvent = currentEvent;
-            ContextLocker lock(context);    // scope lock automatic block...
-            eXosip_automatic_action(context);
+        if(now >= reportDeadline) {
+            reportDeadline = now + REPORT_TIMER;
+            reportDrops();
         }
 
+        dispatch();
+        auto raw = wait(actionDeadline - now);
+        if(!raw)
+            continue;
+
+#ifdef EVENT_TIMING
+        QElapsedTimer cost;
+        cost.start();
+#endif
+        Event event(raw, this);
+
         // skip extra code in event loop if we don't need it...
         if(Server::verbose())
             qDebug() << event;
@@ -287,19 +471,237 @@ void Context::run()
         if(Server::state() == Server::UP && process(event)) {
             ContextLocker lock(context);
             eXosip_default_action(context, event.event());
-            continue;
         }
+#ifdef EVENT_TIMING
+        account(event, cost.nsecsElapsed());
+#endif
     }
+
+    report();
+
+#ifdef EVENT_DRIVEN
+    if(pollFd > -1) {
+        ::close(pollFd);
+        pollFd = -1;
+    }
+#endif
+
     debug() << "Exiting " << objectName();
     emit finished();
     --instanceCount;
 }
 
+#ifdef EVENT_TIMING
+// per event decode and dispatch cost, for benchmarking with sipp
+void Context::account(const Event& event, qint64 nsecs)
+{
+    auto kind = Timing::OTHER;
+    auto msg = event.message();
+    if(event.type() == EXOSIP_MESSAGE_NEW && msg) {
+        if(MSG_IS_OPTIONS(msg))
+            kind = Timing::OPTIONS;
+        else if(MSG_IS_REGISTER(msg))
+            kind = Timing::REGISTER;
+        else if(MSG_IS_MESSAGE(msg))
+            kind = Timing::MESSAGE;
+    }
+    ++timing[kind].count;
+    timing[kind].nsecs += nsecs;
+}
+#endif
+
+void Context::report()
+{
+#ifdef EVENT_TIMING
+    static const char *names[] = {"options", "register", "message", "other"};
+
+    for(unsigned kind = 0; kind < Timing::KINDS; ++kind) {
+        if(!timing[kind].count)
+            continue;
+        debug() << objectName() << ": " << names[kind] << " events=" << timing[kind].count << ", avg=" << timing[kind].nsecs / static_cast<qint64>(timing[kind].count) << "ns";
+    }
+#endif
+
+    reportDrops();
+    auto stats = eventPool->stats();
+    debug() << objectName() << ": pool hits=" << stats.hits << ", misses=" << stats.misses << ", high=" << stats.highWater;
+}
+
+void Context::reportDrops()
+{
+    static const char *names[] = {"sources", "extensions"};
+
+    quint64 total = 0;
+    for(unsigned kind = 0; kind < Admission::KINDS; ++kind)
+        total += admission.stats(static_cast<Admission::Kind>(kind)).dropped;
+    if(total == reportedDrops)
+        return;
+
+    reportedDrops = total;
+    for(unsigned kind = 0; kind < Admission::KINDS; ++kind) {
+        auto stats = admission.stats(static_cast<Admission::Kind>(kind));
+        debug() << objectName() << ": " << names[kind] << " admitted=" << stats.admitted << ", dropped=" << stats.dropped << ", tracked=" << stats.tracked << ", total dropped=" << Admission::dropped(static_cast<Admission::Kind>(kind));
+    }
+}
+
+eXosip_event_t *Context::wait(qint64 timeout)
+{
+#ifdef EVENT_DRIVEN
+    if(pollFd > -1) {
+        // wakeups are drained before the queue is tried, as exosip queues
+        // an event before writing it's wakeup, so an event queued after we
+        // drain always leaves a wakeup for epoll to see.
+        char buf[64];
+        auto wakeups = eXosip_event_geteventsocket(context);
+        while(::read(wakeups, buf, sizeof(buf)) > 0)
+            ;
+
+        auto event = eXosip_event_wait(context, 0, 0);
+        if(event)
+            return event;
+
+        struct epoll_event ready[3];
+        auto count = epoll_wait(pollFd, ready, 3, static_cast<int>(timeout));
+        for(auto pos = 0; pos < count; ++pos) {
+            if(ready[pos].data.fd == eventFd) {
+                quint64 value;  // reset counter, work is dispatched by run
+                auto result = ::read(eventFd, &value, sizeof(value));
+                Q_UNUSED(result);
+            }
+        }
+        return eXosip_event_wait(context, 0, 0);
+    }
+#endif
+    if(timeout > EVENT_TIMER)
+        timeout = EVENT_TIMER;
+    if(timeout < 1)
+        timeout = 1;
+
+    int s = static_cast<int>(timeout / 1000l);
+    int ms = static_cast<int>(timeout % 1000l);
+    return eXosip_event_wait(context, s, ms);
+}
+
+void Context::wakeup()
+{
+#ifdef EVENT_DRIVEN
+    if(eventFd > -1) {
+        quint64 value = 1;
+        if(::write(eventFd, &value, sizeof(value)) < 0)
+            warning() << objectName() << ": cannot wakeup";
+        return;
+    }
+#endif
+    if(context)
+        eXosip_wakeup_event(context);
+}
+
+void Context::dispatch()
+{
+    QList<std::function<void()>> work;
+    workLock.lock();
+    work.swap(workQueue);
+    workLock.unlock();
+
+    foreach(auto job, work) {
+        job();
+    }
+}
+
+void Context::submit(const std::function<void()>& work)
+{
+    workLock.lock();
+    workQueue << work;
+    workLock.unlock();
+    wakeup();
+}
+
+bool Context::listen()
+{
+    const char *ap = nullptr;
+
+    if(!netAddress.isEmpty()) {
+        ap = netAddress.constData();
+    }
+    else if(netAddress == "0.0.0.0")
+        ap = nullptr;
+
+    //qDebug() << "LISTEN " << proto << ap << port << family << NetTLS;
+    if(netWorkers < 2)
+        return eXosip_listen_addr(context, netProto, ap, netPort, netFamily, netTLS) == 0;
+
+#ifdef SO_REUSEPORT
+    // sibling workers each bind their own socket to the same port, and
+    // the kernel then distributes datagrams and connections between them.
+    auto type = (netProto == IPPROTO_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+    auto so = ::socket(netFamily, type, netProto);
+    if(so < 0)
+        return false;
+
+    int on = 1;
+    struct sockaddr_storage store;
+    socklen_t len = sizeof(struct sockaddr_in);
+
+    ::setsockopt(so, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    ::setsockopt(so, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    memset(&store, 0, sizeof(store));
+
+#ifdef AF_INET6
+    if(netFamily == AF_INET6) {
+        auto sin6 = reinterpret_cast<struct sockaddr_in6 *>(&store);
+        ::setsockopt(so, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(netPort);
+        if(!multiInterface) {
+            auto ip6 = netBind.toIPv6Address();
+            memcpy(&sin6->sin6_addr, &ip6, sizeof(sin6->sin6_addr));
+        }
+        len = sizeof(struct sockaddr_in6);
+    }
+    else
+#endif
+    {
+        auto sin = reinterpret_cast<struct sockaddr_in *>(&store);
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(netPort);
+        if(!multiInterface)
+            sin->sin_addr.s_addr = htonl(netBind.toIPv4Address());
+    }
+
+    if(::bind(so, reinterpret_cast<struct sockaddr *>(&store), len) < 0 || (netProto == IPPROTO_TCP && ::listen(so, SOMAXCONN) < 0)) {
+        ::close(so);
+        return false;
+    }
+
+    if(eXosip_set_socket(context, netProto, so, netPort)) {
+        ::close(so);
+        return false;
+    }
+
+    // a pre-bound socket does not tell exosip our port for via and contact
+    // headers, and exosip can only be given the port with an address, so
+    // we masquerade as the bound address, or our host name when bound to
+    // all interfaces.  A single worker instead lets exosip find the local
+    // address that routes to each peer, so when bound to all interfaces
+    // the headers of single and multiple workers may differ.
+    ContextLocker lock(context);
+    eXosip_masquerade_contact(context, multiInterface ? uriHost.constData() : netAddress.constData(), netPort);
+    return true;
+#else
+    return false;
+#endif
+}
+
 void Context::messageResponse(const Event& event)
 {
     osip_header_t *header = nullptr, *endpoint = nullptr;
     auto msg = event.sent();
 
+    // presence deltas are not acknowledged...
+    auto type = msg ? osip_message_get_content_type(msg) : nullptr;
+    if(type && type->subtype && UString(type->subtype) == "presence")
+        return;
+
     if(msg)
         osip_message_header_get_byname(msg, "x-mid", 0, &header);
     if(header)
@@ -315,6 +717,9 @@ void Context::messageResponse(const Event& event)
 
 bool Context::process(const Event& ev)
 {
+    const Method *method;
+    UString address;
+
     switch(ev.type()) {
     case EXOSIP_MESSAGE_REQUESTFAILURE:
         if(MSG_IS_MESSAGE(ev.sent()))
@@ -325,6 +730,10 @@ bool Context::process(const Event& ev)
             messageResponse(ev);
         break;
     case EXOSIP_MESSAGE_NEW:
+        address = peer(ev);
+        if(auto retry = admission.source(address))
+            return busy(ev, retry);
+
         if(MSG_IS_OPTIONS(ev.message())) {
             if(ev.isLocal() && !ev.target().hasUser()) {
                 return reply(ev, SIP_OK);
@@ -341,160 +750,36 @@ bool Context::process(const Event& ev)
                 qDebug() << "Non local registration attempt";
                 return reply(ev, SIP_FORBIDDEN);
             }
+            if(auto retry = admission.extension(ev.number(), address))
+                return busy(ev, retry);
+            if(auto retry = Overload::check(ev, Scheduler::REGISTRATION))
+                return busy(ev, retry);
             emit REQUEST_REGISTER(ev);
             break;
         }
 
-        if(MSG_IS_ROSTER(ev.message())) {
-            if(ev.number() < 1 || ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit REQUEST_ROSTER(ev);
-            return false;
-        }
-
-        if(MSG_IS_PROFILE(ev.message())) {
-            auto to = ev.message()->to;
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(ev.number() < 1 || !ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            if(ev.contentType() != "profile/json" && ev.body().size() > 0)
-                return reply(ev, SIP_NOT_ACCEPTABLE_HERE);
-            emit REQUEST_PROFILE(ev);
-            return false;
-        }
-
-        if(MSG_IS_COVERAGE(ev.message())) {
-            auto to = ev.message()->to;
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(ev.number() < 1 || !ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit REQUEST_COVERAGE(ev);
-            return false;
-        }
-
-        if(MSG_IS_FORWARDING(ev.message())) {
-            auto to = ev.message()->to;
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(ev.number() < 1 || !ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit REQUEST_FORWARDING(ev);
-            return false;
-        }
-
-        if(MSG_IS_ADMIN(ev.message())) {
-            auto to = ev.message()->to;
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(ev.number() < 1 || !ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            if(ev.body().size() > 0)
-                return reply(ev, SIP_NOT_ACCEPTABLE_HERE);
-            emit REQUEST_ADMIN(ev);
-            return false;
-        }
-
-        if(MSG_IS_DROP(ev.message())) {
-            auto to = ev.message()->to;
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(ev.number() < 1 || !ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            if(ev.body().size() > 0)
-                return reply(ev, SIP_NOT_ACCEPTABLE_HERE);
-            emit REQUEST_DROP(ev);
-            return false;
-        }
-
-        if(MSG_IS_MEMBERSHIP(ev.message())) {
-            auto to = ev.message()->to;
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(ev.number() < 1 || !ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            if(ev.body().size() > 0)
-                return reply(ev, SIP_NOT_ACCEPTABLE_HERE);
-            emit REQUEST_MEMBERSHIP(ev);
-            return false;
-        }
-
-        if(MSG_IS_TOPIC(ev.message())) {
-            auto to = ev.message()->to;
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(ev.number() < 1 || !ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit REQUEST_TOPIC(ev);
-            return false;
-        }
-
-        if(MSG_IS_DEVLIST(ev.message())) {
-            if(ev.number() < 1 || ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit REQUEST_DEVLIST(ev);
-            return false;
-        }
-
-        if(MSG_IS_DEVKILL(ev.message())) {
-            if(ev.number() < 1 || ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit REQUEST_DEVKILL(ev);
-            return false;
-        }
-
-        if(MSG_IS_DEAUTHORIZE(ev.message())) {
-            auto to = ev.message()->to;
-            if(ev.number() < 1 || ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(!ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            emit REQUEST_DEAUTHORIZE(ev);
-            return false;
-        }
-
-        if(MSG_IS_AUTHORIZE(ev.message())) {
-            auto to = ev.message()->to;
-            if(ev.number() < 1 || ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            if(!to || !to->url || !to->url->username)
-                return reply(ev, SIP_ADDRESS_INCOMPLETE);
-            if(!ev.toLocal())
-                return reply(ev, SIP_FORBIDDEN);
-            if(ev.contentType() != "authorize/json" || ev.body().size() < 1)
-                return reply(ev, SIP_NOT_ACCEPTABLE_HERE);
-            emit REQUEST_AUTHORIZE(ev);
-            return false;
-        }
-
-        if(MSG_IS_PENDING(ev.message())) {
-            if(ev.number() < 1 || ev.label() == "NONE" || netProto != IPPROTO_TCP)
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit REQUEST_PENDING(ev);
-            return false;
-        }
+        method = methodIndex.find(ev.message()->sip_method);
+        if(method) {
+            auto result = permit(ev, method, schema.proto);
+            if(result != SIP_OK)
+                return reply(ev, result);
+            if(!(method->policy & CRITICAL)) {
+                if(auto retry = admission.extension(ev.number(), address))
+                    return busy(ev, retry);
+                if(auto retry = Overload::check(ev, method->priority))
+                    return busy(ev, retry);
+            }
 
-        if(MSG_IS_ACK_PENDING(ev.message())) {
-            if(ev.number() < 1 || ev.label() == "NONE")
-                return reply(ev, SIP_METHOD_NOT_ALLOWED);
-            emit ACK_PENDING(ev);
+            // authenticated here from the registry snapshot when possible
+            if(ev.authorization()) {
+                auto snapshot = Registry::snapshot();
+                auto entry = snapshot->value({ev.number(), ev.label()});
+                if(entry && Registry::authenticate(*entry, ev) == SIP_OK) {
+                    Manager::accept(method->action, ev, entry->user, entry->endpoint);
+                    return false;
+                }
+            }
+            emit (this->*method->signal)(ev);
             return false;
         }
 
@@ -506,6 +791,10 @@ bool Context::process(const Event& ev)
             // if relaying messages between remotes, no!
             if(ev.number() < 1 && !ev.toLocal())
                 return reply(ev, SIP_FORBIDDEN);
+            if(auto retry = admission.extension(ev.number(), address))
+                return busy(ev, retry);
+            if(auto retry = Overload::check(ev, Scheduler::MESSAGING))
+                return busy(ev, retry);
 
             if(ev.toLocal() && ev.number() < 0) {
                 emit LOCAL_MESSAGE(ev);
@@ -589,27 +878,29 @@ bool Context::message(const UString& from, const UString& to, const UString& rou
     return true;
 }
 
-void Context::challenge(const Event &event, Registry* registry, bool reuse)
+void Context::challenge(const Event &event, Registry* registry, bool reuse, bool stale)
 {
-    char buf[8];
     osip_message_t *msg = nullptr;
     auto ctx = event.context();
     auto context = ctx->context;
     auto tid = event.tid();
     QByteArray random;
 
-    if(reuse)
+    // an expired nonce cannot be re-used...
+    if(reuse && !stale)
         random = registry->nounce();
-    else {
-        eXosip_generate_random(buf, sizeof(buf));
-        random = QByteArray(buf, sizeof(buf));
+    if(random.isEmpty()) {
+        random = Registry::createNonce(registry->endpoint());
+        reuse = false;
     }
 
     UString nonce = random.toHex().toLower();
     UString realm = registry->realm();
     UString digest = registry->digest();
     UString user = registry->user();
-    UString challenge = "Digest realm=" + realm.quote() + ", nonce=" + nonce.quote() + ", algorithm=" + digest.quote();
+    UString challenge = "Digest realm=" + realm.quote() + ", nonce=" + nonce.quote() + ", algorithm=" + digest.quote() + ", qop=\"auth\"";
+    if(stale)
+        challenge += ", stale=true";
     UString expires = UString::number(registry->expires());
 
     if(!reuse)
@@ -627,7 +918,7 @@ void Context::challenge(const Event &event, Registry* registry, bool reuse)
     eXosip_message_send_answer(context, tid, SIP_UNAUTHORIZED, msg);
 }
 
-bool Context::answerWithJson(const Event& event, const QByteArray& json)
+bool Context::answerWithJson(const Event& event, const QByteArray& json, const QList<QPair<UString, UString>>& headers)
 {
     osip_message_t *msg = nullptr;
     auto context = event.context()->context;
@@ -639,6 +930,10 @@ bool Context::answerWithJson(const Event& event, const QByteArray& json)
     if(!msg)
         return false;
 
+    foreach(auto header, headers) {
+        osip_message_set_header(msg, header.first, header.second);
+    }
+
     if(!json.isEmpty()) {
         osip_message_set_body(msg, json.constData(), static_cast<size_t>(json.length()));
         osip_message_set_content_type(msg, "application/json");
@@ -689,6 +984,23 @@ bool Context::authorize(const Event& event, const Registry* registry, const UStr
     return true;
 }
 
+// new requests shed while overloaded are told when to retry
+bool Context::busy(const Event& event, int retry)
+{
+    osip_message_t *msg = nullptr;
+    auto context = event.context()->context;
+    auto tid = event.tid();
+
+    ContextLocker lock(context);
+    eXosip_message_build_answer(context, tid, SIP_SERVICE_UNAVAILABLE, &msg);
+    if(!msg)
+        return false;
+
+    osip_message_set_header(msg, "Retry-After", UString::number(retry));
+    eXosip_message_send_answer(context, tid, SIP_SERVICE_UNAVAILABLE, msg);
+    return true;
+}
+
 bool Context::reply(const Event& event, int code)
 {
     osip_message_t *msg = nullptr;
@@ -714,6 +1026,12 @@ bool Context::reply(const Event& event, int code)
 
 void Context::start(QThread::Priority priority)
 {
+#ifdef EVENT_DRIVEN
+    // shared by all contexts so shutdown can wake every event thread
+    if(shutdownFd < 0)
+        shutdownFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
     foreach(auto context, Contexts) {
         auto thread = new QThread;
         thread->setObjectName(context->objectName());
@@ -738,6 +1056,14 @@ void Context::shutdown()
     debug() << "Shutdown contexts " << instanceCount;
     active = false;
 
+#ifdef EVENT_DRIVEN
+    if(shutdownFd > -1) {
+        quint64 value = 1;
+        if(::write(shutdownFd, &value, sizeof(value)) < 0)
+            warning() << "cannot wakeup contexts";
+    }
+#endif
+
     unsigned hanged = 50;   // up to 5 seconds, after we force...
 
     while(instanceCount && hanged) {
@@ -19,8 +19,10 @@
 #define CONTEXT_HPP_
 
 #include "event.hpp"
+#include "admission.hpp"
 #include <QSqlRecord>
 #include <QJsonDocument>
+#include <functional>
 
 class Registry;
 
@@ -43,6 +45,12 @@ public:
         UNAUTHENTICATED =   1 << 10,    // unathenticated requests allowed
     };
 
+    using Timing = struct {
+        enum : unsigned {OPTIONS, REGISTER, MESSAGE, OTHER, KINDS};
+        quint64 count;
+        qint64 nsecs;
+    };
+
     using Schema = struct {
         UString name;
         UString uri;
@@ -53,7 +61,7 @@ public:
 
     QAbstractSocket::NetworkLayerProtocol protocol();
 
-    Context(const QHostAddress& bind, quint16 port, const Schema& choice, unsigned mask, unsigned index = 1);
+    Context(const QHostAddress& bind, quint16 port, const Schema& choice, unsigned mask, unsigned index = 1, unsigned worker = 0, unsigned workers = 1);
 
     const Contact contact(const UString& username = UString()) const {
         return Contact(uriHost, netPort, username);
@@ -75,6 +83,26 @@ public:
         return schema.inPort;
     }
 
+    inline unsigned index() const {
+        return netIndex;
+    }
+
+    inline unsigned worker() const {
+        return netWorker;
+    }
+
+    inline unsigned workers() const {
+        return netWorkers;
+    }
+
+    inline EventPool *pool() const {
+        return eventPool;
+    }
+
+    inline bool isSibling(const Context *other) const {
+        return other != nullptr && other->netIndex == netIndex && other->schema.name == schema.name;
+    }
+
     inline bool isLocal(const UString& host) const {
         if(localHosts.contains(host))
             return true;
@@ -93,21 +121,26 @@ public:
         return instanceCount > 0;
     }
 
+    const QList<Context *> siblings() const;
+
     const UString uriTo(const UString& id, const QList<QPair<UString, UString> > &args = QList<QPair<UString,UString>>()) const;
     const UString uriFrom(const UString& id = UString()) const;
     const UString hostname() const;
     void applyHostnames(const QStringList& names, const QString& host);
     const UString uriTo(const Contact& address) const;
     bool message(const UString& from, const UString& to, const UString& route, QList<QPair<UString, UString> > &headers, const UString &type, const QByteArray &body);
+    void submit(const std::function<void()>& work);
 
-    static void challenge(const Event& event, Registry *registry, bool reuse = false);
-    static bool answerWithJson(const Event& event, const QByteArray& json);
+    static void challenge(const Event& event, Registry *registry, bool reuse = false, bool stale = false);
+    static bool answerWithJson(const Event& event, const QByteArray& json, const QList<QPair<UString, UString>>& headers = QList<QPair<UString, UString>>());
     static bool reply(const Event& event, int code);
+    static bool busy(const Event& event, int retry);
     static bool answerWithTimestamp(const Event& event, int code = SIP_OK);
     static bool authorize(const Event& event, const Registry* registry, const UString &xdp);
     static void start(QThread::Priority priority = QThread::InheritPriority);
     static void shutdown();
     static void dump(const osip_message_t *msg);
+    static bool isReusable();
 
 private:
     ~Context() final;
@@ -115,15 +148,36 @@ private:
     const Schema schema;
     unsigned allow;
     eXosip_t *context;
-    time_t currentEvent, priorEvent;
+    EventPool *eventPool;
+    int eventFd, pollFd;
+    qint64 actionDeadline, reportDeadline;
+    QElapsedTimer actionTimer;
+    QMutex workLock;
+    QList<std::function<void()>> workQueue;
+#ifdef EVENT_TIMING
+    Timing timing[Timing::KINDS];
+#endif
+    Admission admission;
+    quint64 reportedDrops;
     int netFamily, netTLS, netProto;
     quint16 netPort;
+    unsigned netIndex, netWorker, netWorkers;
+    QHostAddress netBind;
     UString netAddress, uriAddress, uriHost, publicName;
     QStringList localHosts, otherNames;
     mutable QMutex nameLock;
     bool multiInterface;
 
     const QStringList localnames() const;
+    bool listen();
+    void wakeup();
+    void dispatch();
+#ifdef EVENT_TIMING
+    void account(const Event& event, qint64 nsecs);
+#endif
+    void report();
+    void reportDrops();
+    eXosip_event_t *wait(qint64 timeout);
     bool process(const Event& ev);
     void messageResponse(const Event& ev);
 
@@ -163,7 +217,8 @@ private slots:
 /*!
  * Manage exosip context threads.  These threads can emit signals back
  * to the stack, but cannot receive signals as they run inside an exosip
- * event loop.
+ * event loop.  Work may instead be submitted to a context thread, which
+ * wakes it from its event wait.
  * \file context.hpp
  */
 
@@ -175,9 +230,25 @@ private slots:
  * default the first index is often presumed to be the gateway contexts for
  * connecting with external sip providers and p2p calls.
  *
+ * A schema may be served by more than one worker context bound to the
+ * same address and port with SO_REUSEPORT, so that the kernel spreads
+ * incoming traffic over several event threads.  Workers of the same index
+ * and schema are siblings.  A transaction is always answered through the
+ * worker that received it, and a registration follows the sibling its
+ * endpoint last authenticated through.
+ *
  * Each context runs it's own exosip2 event thread.  These threads then
  * will signal events back to the stack, thereby serializing requests under
- * the stack's own thread context.  All low level access to exosip2 functions
+ * the stack's own thread context.  On Linux the event thread blocks in
+ * epoll on the exosip event socket and an eventfd used for submitted work,
+ * and exosip automatic actions are run from a deadline.  Other platforms
+ * poll exosip with a short timer.  Extension (X-) methods are found in a
+ * static method table by a compile-time checked perfect hash, and each
+ * entry declares the transport, caller, locality, and body policy that a
+ * request must meet before its signal is emitted.  New requests are first
+ * checked against the Admission buckets of their source and extension, and
+ * those over rate are answered 503 before any further work is done on
+ * them.  All low level access to exosip2 functions
  * will occur thru context member functions, as Context also supports eXosip
  * locking internally.
  * \author David Sugar <tychosoft@gmail.com>
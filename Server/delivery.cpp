@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "manager.hpp"
+#include "delivery.hpp"
+
+#define DELIVERY_QUEUE 64       // messages held per endpoint...
+#define DELIVERY_WINDOW 4       // messages awaiting response per endpoint...
+#define DELIVERY_PACE 20l       // msecs between sends to an endpoint...
+#define DELIVERY_TIMEOUT 32000l // msecs to wait for a response...
+#define DELIVERY_BACKOFF 1000l  // msecs before first retry...
+#define DELIVERY_RETRIES 5      // before left for pending...
+#define DELIVERY_BURST 64       // sends to all endpoints per tick...
+
+namespace {
+QHash<qlonglong, Delivery *> deliveries;
+TimerWheel schedule(10l);
+unsigned budget = DELIVERY_BURST;
+
+// adjusts message from and to based on registering entity delivery
+bool send(Registry *reg, const QVariantHash& data)
+{
+    auto context = reg->context();
+    UString type = data["c"].toByteArray();
+    UString from = data["f"].toByteArray();
+    UString to = data["t"].toByteArray();
+    UString route = context->prefix() + reg->route();
+    UString display = data["d"].toByteArray();
+    UString topic = data["s"].toByteArray();
+    UString label = reg->label();
+
+    if(label == "NONE" && type == "text/admin") {
+        type = "text/plain";
+        topic = "X-Admin";
+    }
+
+    if(label == "NONE" && type != "text/plain")
+        return false;
+
+    if(from.toInt() == reg->extension() || from == reg->user())
+        from = context->prefix() + UString::number(reg->extension()) + "@" + reg->origin();
+    else if(from.indexOf('@') < 1)
+        from = context->prefix() + from + "@" + reg->origin();
+
+    if(to.toInt() == reg->extension() || to == reg->user())
+        to = context->prefix() + UString::number(reg->extension()) + "@" + reg->origin();
+    else if(to.indexOf('@') < 1)
+        to = context->prefix() + to + "@" + reg->origin();
+
+    if(display.isEmpty())
+        from = "<" + from + ">";
+    else
+        from = "\"" + display + "\" <" + from + ">";
+    to = "<" + to + ">";
+
+    // presence deltas are not stored messages...
+    QList<QPair<UString,UString>> headers;
+    if(type == "text/presence")
+        headers << qMakePair(UString("X-EP"), UString::number(reg->endpoint()));
+    else
+        headers = {
+            {"Subject", topic},
+            {"X-MID", data["r"].toString()},
+            {"X-EP", QString::number(reg->endpoint())},
+            {"X-TS", data["p"].toDateTime().toString(Qt::ISODate)},
+            {"X-MS", data["u"].toString()},
+        };
+
+    qDebug() << "Sending Message FROM" << from << "TO" << to << "VIA" << route;
+    auto body = data["b"].toByteArray();
+    context->submit([=]() mutable {
+        context->message(from, to, route, headers, type, body);
+    });
+    return true;
+}
+
+// a client rejecting a message is final, a busy or missing one is not...
+bool isRetryable(int status)
+{
+    return status <= 0 || status == SIP_REQUEST_TIME_OUT || status == SIP_TEMPORARILY_UNAVAILABLE || status >= 500;
+}
+} // namespace
+
+Delivery::Delivery(qlonglong id) :
+endpoint(id), last(-DELIVERY_PACE)
+{
+    deliveries.insert(endpoint, this);
+}
+
+Delivery::~Delivery()
+{
+    deliveries.remove(endpoint);
+}
+
+bool Delivery::post(qlonglong endpoint, const QVariantHash& data)
+{
+    auto delivery = deliveries.value(endpoint);
+    if(!delivery)
+        delivery = new Delivery(endpoint);
+
+    if(delivery->queue.count() >= DELIVERY_QUEUE) {
+        qDebug() << "Delivery queue full for" << endpoint;
+        return false;
+    }
+
+    delivery->queue << Item{data, 0, schedule.elapsed()};
+    delivery->reschedule();
+    return true;
+}
+
+// drain an endpoint's queue as soon as it registers again
+void Delivery::activate(qlonglong endpoint)
+{
+    auto delivery = deliveries.value(endpoint);
+    if(!delivery)
+        return;
+
+    auto now = schedule.elapsed();
+    for(auto& item : delivery->queue)
+        item.due = now;
+    delivery->reschedule();
+}
+
+void Delivery::response(const QByteArray& mid, qlonglong endpoint, int status)
+{
+    auto delivery = deliveries.value(endpoint);
+    if(!delivery)
+        return;
+
+    auto item = delivery->sent.constFind(mid);
+    if(item == delivery->sent.constEnd())
+        return;
+
+    auto result = *item;
+    delivery->sent.remove(mid);
+    if(status >= 300)
+        delivery->retry(result, status);
+    delivery->reschedule();
+}
+
+void Delivery::remove(qlonglong endpoint)
+{
+    delete deliveries.value(endpoint);
+}
+
+unsigned Delivery::advance()
+{
+    budget = DELIVERY_BURST;
+    return schedule.advance();
+}
+
+unsigned Delivery::count()
+{
+    return schedule.count();
+}
+
+void Delivery::retry(Item item, int status)
+{
+    if(!isRetryable(status) || ++item.attempts >= DELIVERY_RETRIES) {
+        qDebug() << "Delivery of" << item.data["r"].toByteArray() << "to" << endpoint << "left pending, status" << status;
+        return;
+    }
+
+    // retried ahead of the queue, to keep messages in order...
+    item.due = schedule.elapsed() + (DELIVERY_BACKOFF << (item.attempts - 1));
+    queue.prepend(item);
+}
+
+// wake for the next send or response deadline, if any
+void Delivery::reschedule()
+{
+    auto active = Registry::findActive(endpoint) != nullptr;
+
+    qint64 next = -1;
+    if(active && !queue.isEmpty() && sent.count() < DELIVERY_WINDOW)
+        next = qMax(queue.first().due, last + DELIVERY_PACE);
+
+    foreach(const auto& item, sent) {
+        if(next < 0 || item.due < next)
+            next = item.due;
+    }
+
+    if(next > -1)
+        schedule.schedule(this, next);
+    else {
+        schedule.cancel(this);
+        if(queue.isEmpty() && sent.isEmpty())
+            delete this;
+    }
+}
+
+void Delivery::expired()
+{
+    auto now = schedule.elapsed();
+
+    // responses overdue are treated as failed deliveries...
+    foreach(auto mid, sent.keys()) {
+        auto item = sent.value(mid);
+        if(item.due <= now) {
+            sent.remove(mid);
+            retry(item, 0);
+        }
+    }
+
+    auto registry = Registry::findActive(endpoint);
+    while(registry && !queue.isEmpty() && sent.count() < DELIVERY_WINDOW) {
+        if(!budget || now < last + DELIVERY_PACE || now < queue.first().due)
+            break;
+
+        auto item = queue.takeFirst();
+        if(!send(registry, item.data))
+            continue;
+
+        --budget;
+        last = now;
+
+        // a lost presence delta is resynced by the client, not retried
+        if(item.data["c"].toByteArray() == "text/presence")
+            continue;
+
+        item.due = now + DELIVERY_TIMEOUT;
+        sent.insert(item.data["r"].toByteArray(), item);
+    }
+    reschedule();
+}
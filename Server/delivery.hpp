@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DELIVERY_HPP_
+#define DELIVERY_HPP_
+
+#include "../Common/compiler.hpp"
+#include "timerwheel.hpp"
+
+#include <QVariantHash>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+
+class Delivery final : public TimerWheel::Timer
+{
+    Q_DISABLE_COPY(Delivery)
+
+public:
+    static bool post(qlonglong endpoint, const QVariantHash& data);
+    static void activate(qlonglong endpoint);
+    static void response(const QByteArray& mid, qlonglong endpoint, int status);
+    static void remove(qlonglong endpoint);
+    static unsigned advance();
+    static unsigned count();
+
+private:
+    using Item = struct {
+        QVariantHash data;
+        unsigned attempts;
+        qint64 due;                     // retry or response deadline
+    };
+
+    qlonglong endpoint;
+    QList<Item> queue;                  // waiting to be sent, in order
+    QHash<QByteArray, Item> sent;       // awaiting response, by mid
+    qint64 last;                        // last sent on delivery clock
+
+    explicit Delivery(qlonglong id);
+    ~Delivery() final;
+
+    void retry(Item item, int status);
+    void reschedule();                  // may delete when done
+    void expired() final;
+};
+
+/*!
+ * Paced delivery of messages to registered endpoints.
+ * \file delivery.hpp
+ */
+
+/*!
+ * \class Delivery
+ * \brief Outbound message queue of one endpoint.
+ * Messages to an endpoint are queued in the stack thread and sent at a
+ * paced rate, with only a small window of them awaiting a response at
+ * once, so that a burst to a large group or the lobby is spread out rather
+ * than sent to a slow client, or the socket, all at once.  A message that
+ * fails, or is not answered in time, is retried with exponential backoff
+ * up to a limit.  Presence deltas are paced thru the same queues, but are
+ * not awaited or retried, as a client resyncs on a gap in them.  Queues of
+ * inactive endpoints are held, up to a bound, and drained as soon as the
+ * endpoint registers again, and are released with the registration when it
+ * expires or de-registers.  Anything dropped or given up on remains pending
+ * in the database, and is sent the next time the client asks for pending
+ * messages.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Delivery::post(qlonglong endpoint, const QVariantHash& data)
+ * \param endpoint Registered endpoint to send to.
+ * \param data Message as posted by the database.
+ * \return false if dropped because the endpoint's queue is full.
+ *
+ * \fn Delivery::advance()
+ * Sends or retries anything now due, up to a burst for all endpoints.
+ * Called only from the delivery timer's tick.
+ * \return number of endpoint queues serviced.
+ */
+
+#endif
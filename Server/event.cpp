@@ -17,6 +17,7 @@
 
 #include "context.hpp"
 #include <atomic>
+#include <cstddef>
 #include <QDebug>
 
 #ifndef SESSION_EXPIRES
@@ -27,52 +28,154 @@ namespace {
 std::atomic<unsigned> atomicSequence;
 }
 
+// keeps event data aligned after the block header
+const size_t EventPool::header = (sizeof(EventPool::Block) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+EventPool::EventPool(size_t size) :
+blockSize(size), local(nullptr), returned(nullptr), refs(1), hits(0), misses(0), highWater(0)
+{
+}
+
+EventPool::~EventPool()
+{
+}
+
+void *EventPool::allocate(size_t size)
+{
+    auto block = static_cast<Block *>(::operator new(header + size));
+    block->pool = nullptr;
+    block->next = nullptr;
+    return reinterpret_cast<char *>(block) + header;
+}
+
+void EventPool::release(void *ptr)
+{
+    if(!ptr)
+        return;
+
+    auto block = reinterpret_cast<Block *>(static_cast<char *>(ptr) - header);
+    if(block->pool)
+        block->pool->recycle(block);
+    else
+        ::operator delete(block);
+}
+
+void *EventPool::acquire()
+{
+    auto inUse = refs.fetch_add(1, std::memory_order_relaxed);
+    if(inUse > highWater)
+        highWater = inUse;
+
+    if(!local)
+        local = returned.exchange(nullptr, std::memory_order_acquire);
+
+    auto block = local;
+    if(block) {
+        local = block->next;
+        ++hits;
+    }
+    else {
+        block = static_cast<Block *>(::operator new(header + blockSize));
+        block->pool = this;
+        ++misses;
+    }
+    block->next = nullptr;
+    return reinterpret_cast<char *>(block) + header;
+}
+
+void EventPool::recycle(Block *block)
+{
+    auto head = returned.load(std::memory_order_relaxed);
+    do {
+        block->next = head;
+    } while(!returned.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        destroy();
+}
+
+void EventPool::close()
+{
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        destroy();
+}
+
+void EventPool::destroy()
+{
+    auto block = returned.exchange(nullptr, std::memory_order_acquire);
+    while(block) {
+        auto next = block->next;
+        ::operator delete(block);
+        block = next;
+    }
+    while(local) {
+        auto next = local->next;
+        ::operator delete(local);
+        local = next;
+    }
+    delete this;
+}
+
+void *Event::Data::operator new(size_t size)
+{
+    return EventPool::allocate(size);
+}
+
+void *Event::Data::operator new(size_t size, EventPool *pool)
+{
+    if(!pool)
+        return EventPool::allocate(size);
+    Q_ASSERT(size == sizeof(Event::Data));
+    return pool->acquire();
+}
+
+void Event::Data::operator delete(void *ptr)
+{
+    EventPool::release(ptr);
+}
+
+void Event::Data::operator delete(void *ptr, EventPool *pool)
+{
+    Q_UNUSED(pool);
+    EventPool::release(ptr);
+}
+
 Event::Data::Data() :
-number(-1), expires(-1), status(0), hops(0), natted(false), isLocal(false), toLocal(false), associated(false), record(false), context(nullptr), event(nullptr), message(nullptr), authorization(nullptr), sequenceOrder(0)
+number(-1), expires(-1), status(0), hops(0), natted(false), isLocal(false), toLocal(false), associated(false), record(false), context(nullptr), event(nullptr), message(nullptr), authorization(nullptr), payload(nullptr), created(0), sequenceOrder(0), decoded(ALL)
 {
 }
 
 Event::Data::Data(eXosip_event_t *evt, Context *ctx, int seq) :
-number(-1), expires(-1), status(0), hops(0), natted(false), isLocal(false), toLocal(false), associated(false), record(false), context(ctx), event(evt), message(nullptr), authorization(nullptr), sequenceOrder(seq)
+number(-1), expires(-1), status(0), hops(0), natted(false), isLocal(false), toLocal(false), associated(false), record(false), context(ctx), event(evt), message(nullptr), authorization(nullptr), payload(nullptr), created(0), sequenceOrder(seq), decoded(0)
 {
     // start time of event creation
     elapsed.start();
-    timestamp = QDateTime::currentDateTime();
-    QDateTime utc = timestamp.toUTC();
-    utc.setTimeSpec(Qt::LocalTime);
-    timestamp.setUtcOffset(static_cast<int>(utc.secsTo(timestamp)));
+    created = QDateTime::currentMSecsSinceEpoch();
 
     // ignore constructor parser if empty event;
     if(!evt) {
         context = nullptr;
+        decoded.store(ALL, std::memory_order_relaxed);
         return;
     }
 
-    // start of event decompose by event type...
+    // start of event decompose by event type, only what pre-filters need...
     switch(evt->type) {
     case EXOSIP_MESSAGE_ANSWERED:
     case EXOSIP_REGISTRATION_SUCCESS:       // provider succeeded
     case EXOSIP_REGISTRATION_FAILURE:       // provider failed
         status = evt->response->status_code;
         reason = evt->response->reason_phrase;
-        parseMessage(evt->response);
+        message = evt->response;
         break;
     case EXOSIP_MESSAGE_NEW:
     case EXOSIP_CALL_INVITE:
         method = evt->request->sip_method;
+        message = evt->request;
         if(osip_message_get_authorization(evt->request, 0, &authorization) != 0 || !authorization->username || !authorization->response)
             authorization = nullptr;
-        parseMessage(evt->request);
-        if(evt->request->req_uri && evt->request->req_uri->host) {
-            target = Contact(evt->request->req_uri);
-            char *uri = nullptr;
-            osip_uri_to_str(evt->request->req_uri, &uri);
-            if(uri) {
-                request = uri;      // for consistent auth processing
-                osip_free(uri);
-            }
-            isLocal = ctx->isLocal(target.host());
-        }
+        if(evt->request->req_uri && evt->request->req_uri->host)
+            isLocal = ctx->isLocal(evt->request->req_uri->host);
         if(evt->request && evt->request->to && event->request->to->url && evt->request->to->url->username)
             toLocal = ctx->isLocal(evt->request->to->url->host);
         if(method == "REGISTER") {
@@ -94,6 +197,59 @@ number(-1), expires(-1), status(0), hops(0), natted(false), isLocal(false), toLo
         break;
     }
 
+    if(message) {
+        osip_message_get_body(message, 0, &payload);
+        if(payload && (!payload->body || !payload->length))
+            payload = nullptr;
+    }
+}
+
+Event::Data::~Data()
+{
+    if(event) {
+        qDebug().nospace() << "~Event(" << event->type << ",cid=" << event->cid << ",did=" << event->did << ",ctx=" << context->objectName() << ")";
+        eXosip_event_free(event);
+        event = nullptr;
+    }
+}
+
+void Event::Data::decode(unsigned groups)
+{
+    QMutexLocker lock(&decodeLock);
+    auto pending = groups & ~decoded.load(std::memory_order_relaxed);
+    if(!pending)
+        return;
+
+    if(pending & TIMESTAMP)
+        parseTimestamp();
+    if(pending & AUTHORIZE)
+        parseAuthorize();
+    if(pending & TARGET)
+        parseTarget();
+    if(pending & VIAS)
+        parseVias();
+    if(pending & HEADERS)
+        parseHeaders();
+    if(pending & LISTS)
+        parseLists();
+    if(pending & PARTIES)
+        parseParties();
+    if(pending & CONTENT)
+        parseContent();
+
+    decoded.fetch_or(pending, std::memory_order_release);
+}
+
+void Event::Data::parseTimestamp()
+{
+    timestamp = QDateTime::fromMSecsSinceEpoch(created);
+    QDateTime utc = timestamp.toUTC();
+    utc.setTimeSpec(Qt::LocalTime);
+    timestamp.setUtcOffset(static_cast<int>(utc.secsTo(timestamp)));
+}
+
+void Event::Data::parseAuthorize()
+{
     // parse out authorization for later use
     if(authorization && authorization->username)
         userid = UString(authorization->username).unquote();
@@ -105,31 +261,37 @@ number(-1), expires(-1), status(0), hops(0), natted(false), isLocal(false), toLo
         realm = UString(authorization->realm).unquote();
     if(authorization && authorization->algorithm)
         algorithm = UString(authorization->algorithm).unquote().toUpper();
+    if(authorization && authorization->message_qop)
+        qop = UString(authorization->message_qop).unquote().toLower();
+    if(authorization && authorization->cnonce)
+        cnonce = UString(authorization->cnonce).unquote();
+    if(authorization && authorization->nonce_count)
+        nonceCount = UString(authorization->nonce_count).unquote();
 }
 
-Event::Data::~Data()
+void Event::Data::parseTarget()
 {
-    if(event) {
-        qDebug().nospace() << "~Event(" << event->type << ",cid=" << event->cid << ",did=" << event->did << ",ctx=" << context->objectName() << ",source=" << source.toString() << ")";
-        eXosip_event_free(event);
-        event = nullptr;
+    if(!message || !MSG_IS_REQUEST(message) || !message->req_uri || !message->req_uri->host)
+        return;
+
+    target = Contact(message->req_uri);
+    char *uri = nullptr;
+    osip_uri_to_str(message->req_uri, &uri);
+    if(uri) {
+        request = uri;      // for consistent auth processing
+        osip_free(uri);
     }
 }
 
-void Event::Data::parseMessage(osip_message_t *msg)
+void Event::Data::parseVias()
 {
-    const osip_list_t& clist = msg->contacts;
-    const osip_list_t& vlist = msg->vias;
-    const osip_list_t& rlist = msg->record_routes;
-    const osip_list_t& alist = msg->allows;
-    int pos;
-    Contact nat;
-
-    message = msg;
-    if(!msg)
+    if(!message)
         return;
 
-    pos = 0;
+    const osip_list_t& vlist = message->vias;
+    int pos = 0;
+    Contact nat;
+
     while(osip_list_eol(&vlist, pos) == 0) {
         auto via = static_cast<osip_via_t *>(osip_list_get(&vlist, pos++));
         ++hops;
@@ -161,7 +323,14 @@ void Event::Data::parseMessage(osip_message_t *msg)
         natted = true;
         source = nat;
     }
+}
+
+void Event::Data::parseHeaders()
+{
+    if(!message)
+        return;
 
+    auto msg = message;
     osip_header_t *header;
 
     header = nullptr;
@@ -200,7 +369,18 @@ void Event::Data::parseMessage(osip_message_t *msg)
     osip_message_header_get_byname(msg, "subject", 0, &header);
     if(header && header->hvalue)
         subject = header->hvalue;
+}
 
+void Event::Data::parseLists()
+{
+    if(!message)
+        return;
+
+    auto msg = message;
+    const osip_list_t& clist = msg->contacts;
+    const osip_list_t& rlist = msg->record_routes;
+    const osip_list_t& alist = msg->allows;
+    int pos;
 
     pos = 0;
     while(osip_list_eol(&alist, pos) == 0) {
@@ -237,7 +417,14 @@ void Event::Data::parseMessage(osip_message_t *msg)
             }
         }
     }
+}
+
+void Event::Data::parseParties()
+{
+    if(!message)
+        return;
 
+    auto msg = message;
     if(msg->from) {
         from = msg->from->url;
         if(msg->from->displayname)
@@ -248,17 +435,21 @@ void Event::Data::parseMessage(osip_message_t *msg)
 
     if(msg->to)
         to = msg->to->url;
+}
+
+void Event::Data::parseContent()
+{
+    if(!message)
+        return;
 
+    auto msg = message;
     if(msg->content_type && msg->content_type->type) {
         content = msg->content_type->type;
         if(msg->content_type->subtype)
             content += UString("/") + msg->content_type->subtype;
     }
 
-    osip_body_t *data = nullptr;
-    osip_message_get_body(msg, 0, &data);
-    if(data && data->length) {
-        body = QByteArray(data->body, static_cast<int>(data->length));
+    if(payload) {
         auto type = osip_message_get_content_type(msg);
         if(type && type->subtype)
             contentType = UString(type->type) + "/" + type->subtype;
@@ -278,7 +469,12 @@ Event::Event(eXosip_event_t *evt, Context *ctx)
     if(evt)
         next = atomicSequence.fetch_add(1, std::memory_order_relaxed) % 10000;
 
-    d = new Event::Data(evt, ctx, next);
+    d = new(ctx ? ctx->pool() : nullptr) Event::Data(evt, ctx, next);
+}
+
+size_t Event::dataSize()
+{
+    return sizeof(Event::Data);
 }
 
 int Event::nextSequence() const
@@ -334,9 +530,10 @@ const UString Event::uriContext(const UString& username) const
 // used for events that support only one contact object...
 const Contact Event::contact() const
 {
-    if(d->contacts.size() != 1)
+    auto list = contacts();
+    if(list.size() != 1)
         return Contact();
-    return d->contacts[0];
+    return list[0];
 }
 
 const UString Event::protocol() const
@@ -29,9 +29,53 @@
 #include <QAbstractSocket>
 #include <QSharedData>
 #include <QElapsedTimer>
+#include <atomic>
 
 class Context;
 
+class EventPool final
+{
+    Q_DISABLE_COPY(EventPool)
+
+public:
+    using Stats = struct {
+        quint64 hits, misses;
+        unsigned highWater;
+    };
+
+    explicit EventPool(size_t size);
+
+    void *acquire();
+    void close();
+
+    inline const Stats stats() const {
+        return {hits, misses, highWater};
+    }
+
+    static void *allocate(size_t size);
+    static void release(void *ptr);
+
+private:
+    struct Block {
+        EventPool *pool;
+        Block *next;
+    };
+
+    ~EventPool();
+
+    size_t blockSize;
+    Block *local;                       // owning context thread only
+    std::atomic<Block *> returned;      // pushed by consuming threads
+    std::atomic<unsigned> refs;         // owner plus blocks in use
+    quint64 hits, misses;
+    unsigned highWater;
+
+    void recycle(Block *block);
+    void destroy();
+
+    static const size_t header;
+};
+
 class Event final
 {
 public:
@@ -72,11 +116,11 @@ public:
     }
 
     inline const QList<Contact>& contacts() const {
-        return d->contacts;
+        return decode(Data::LISTS)->contacts;
     }
 
     inline const QList<Contact>& routes() const {
-        return d->routes;
+        return decode(Data::LISTS)->routes;
     }
 
     inline int sequence() const {
@@ -84,7 +128,7 @@ public:
     }
 
     inline int expires() const {
-        return d->expires;
+        return decode(Data::HEADERS)->expires;
     }
 
     inline int status() const {
@@ -92,7 +136,7 @@ public:
     }
 
     inline const UString agent() const {
-        return d->agent;
+        return decode(Data::HEADERS)->agent;
     }
 
     inline const UString reason() const {
@@ -104,35 +148,47 @@ public:
     }
 
     inline int hops() const {
-        return d->hops;
+        return decode(Data::VIAS)->hops;
     }
 
     inline bool record() const {
-        return d->record;
+        return decode(Data::LISTS)->record;
     }
 
     inline const Contact source() const {
-        return d->source;
+        return decode(Data::VIAS)->source;
     }
 
     inline const UString authorizingId() const {
-        return d->userid;
+        return decode(Data::AUTHORIZE)->userid;
     }
 
     inline const UString authorizingDigest() const {
-        return d->digest;
+        return decode(Data::AUTHORIZE)->digest;
     }
 
     inline const UString authorizingOnce() const {
-        return d->nonce;
+        return decode(Data::AUTHORIZE)->nonce;
     }
 
     inline const UString authorizingRealm() const {
-        return d->realm;
+        return decode(Data::AUTHORIZE)->realm;
     }
 
     inline const UString authorizingAlgorithm() const {
-        return d->algorithm;
+        return decode(Data::AUTHORIZE)->algorithm;
+    }
+
+    inline const UString authorizingQop() const {
+        return decode(Data::AUTHORIZE)->qop;
+    }
+
+    inline const UString authorizingCnonce() const {
+        return decode(Data::AUTHORIZE)->cnonce;
+    }
+
+    inline const UString authorizingCount() const {
+        return decode(Data::AUTHORIZE)->nonceCount;
     }
 
     inline osip_authorization_t *authorization() const {
@@ -144,35 +200,35 @@ public:
     }
 
     inline const Contact from() const {
-        return d->from;
+        return decode(Data::PARTIES)->from;
     }
 
     inline const Contact to() const {
-        return d->to;
+        return decode(Data::PARTIES)->to;
     }
 
     inline const UString display() const {
-        return d->display;
+        return decode(Data::PARTIES)->display;
     }
 
     inline const UString request() const {
-        return d->request;
+        return decode(Data::TARGET)->request;
     }
 
     inline const Contact target() const {
-        return d->target;
+        return decode(Data::TARGET)->target;
     }
 
     inline const UString uriSource() const {
-        return uri(d->source);
+        return uri(source());
     }
 
     inline const UString uriTarget() const {
-        return uri(d->target);
+        return uri(target());
     }
 
     inline bool isNatted() const {
-        return d->natted;
+        return decode(Data::VIAS)->natted;
     }
 
     inline bool isLocal() const {
@@ -191,24 +247,27 @@ public:
         return d->message;
     }
 
+    // view of message body, only valid while the event exists
     inline const QByteArray body() const {
-        return d->body;
+        if(!d->payload)
+            return QByteArray();
+        return QByteArray::fromRawData(d->payload->body, static_cast<int>(d->payload->length));
     }
 
     inline const UString content() const {
-        return d->content;
+        return decode(Data::CONTENT)->content;
     }
 
     inline const UString subject() const {
-        return d->subject;
+        return decode(Data::HEADERS)->subject;
     }
 
     inline const UString initialize() const {
-        return d->initialize;
+        return decode(Data::HEADERS)->initialize;
     }
 
     inline const UString contentType() const {
-        return d->contentType;
+        return decode(Data::CONTENT)->contentType;
     }
 
     inline int cid() const {
@@ -236,23 +295,25 @@ public:
     }
 
     inline QList<UString> allows() const {
-        return d->allows;
+        return decode(Data::LISTS)->allows;
     }
 
     inline QString label() const {
-        return d->label;
+        return decode(Data::HEADERS)->label;
     }
 
     inline QDateTime timestamp() const {
-        return d->timestamp;
+        return decode(Data::TIMESTAMP)->timestamp;
     }
 
     inline QByteArray deviceKey() const {
-        return d->deviceKey;
+        return decode(Data::HEADERS)->deviceKey;
     }
 
     int nextSequence() const;
 
+    static size_t dataSize();
+
     const UString uriTo(const UString& id) const;
     const UString protocol() const;
     const UString toString() const;
@@ -266,10 +327,28 @@ private:
 	{
         Q_DISABLE_COPY(Data)        // can never deep copy...
 	public:
+        // groups of fields decoded on first access
+        enum Decode : unsigned {
+            TIMESTAMP =     1 << 0,
+            AUTHORIZE =     1 << 1,
+            TARGET =        1 << 2,
+            VIAS =          1 << 3,
+            HEADERS =       1 << 4,
+            LISTS =         1 << 5,
+            PARTIES =       1 << 6,
+            CONTENT =       1 << 7,
+            ALL =           0xff,
+        };
+
         Data();
         Data(eXosip_event_t *evt, Context *ctx, int sequence);
         ~Data();
 
+        static void *operator new(size_t size);
+        static void *operator new(size_t size, EventPool *pool);
+        static void operator delete(void *ptr);
+        static void operator delete(void *ptr, EventPool *pool);
+
         int number;                 // referencing extension # or -1
         int expires;                // longest expiration
         int status;
@@ -279,23 +358,43 @@ private:
         eXosip_event_t *event;
         osip_message_t *message;
         osip_authorization_t *authorization;
+        osip_body_t *payload;       // body owned by exosip event
         QList<Contact> contacts, routes;
         UString agent, method, subject, text, content, realm, reason, initialize;
         UString userid, nonce, digest, algorithm, request, contentType, display;
+        UString qop, cnonce, nonceCount;
         QByteArray deviceKey;      // device public key...
         QString label;
         Contact source;  // if nat, has first nat
         Contact from, to, target;
         QList<UString> allows;
-        QByteArray body;
         QElapsedTimer elapsed;
         QDateTime timestamp;
+        qint64 created;
         int sequenceOrder;
-
-        void parseMessage(osip_message_t *msg);
+        std::atomic<unsigned> decoded;
+        QMutex decodeLock;
+
+        void decode(unsigned groups);
+        void parseTimestamp();
+        void parseAuthorize();
+        void parseTarget();
+        void parseVias();
+        void parseHeaders();
+        void parseLists();
+        void parseParties();
+        void parseContent();
     };
 
     QSharedDataPointer<Event::Data> d;
+
+    // event data is shared across threads, so decoding is once only
+    inline const Data *decode(unsigned groups) const {
+        auto data = d.constData();
+        if((data->decoded.load(std::memory_order_acquire) & groups) != groups)
+            const_cast<Data *>(data)->decode(groups);
+        return data;
+    }
 };
 
 QDebug operator<<(QDebug dbg, const Event& evt);
@@ -311,6 +410,14 @@ Q_DECLARE_METATYPE(Event)
  */
 
 /*!
+ * \class EventPool
+ * \brief Recycles event data for a context.
+ * Each context keeps a pool of event data blocks.  Blocks are taken only by
+ * the owning context thread, and are returned from whatever thread drops
+ * the last copy of an event thru a lock-free list, which the context then
+ * takes back in one exchange.  The pool lives until both its context and
+ * every block it handed out are gone.
+ *
  * \class Event
  * \brief Container for SIP Events.
  * Each SIP event generates an implicitly shared SIP event object.  This
@@ -319,11 +426,14 @@ Q_DECLARE_METATYPE(Event)
  * slots.  Exosip2 memory management for these data structures will also
  * be buried inside here.
  *
- * A lot of computation and parsing for lists, to determine nat and source
- * address, contacts, etc, happens in the constructor automatically for 
- * every event.  The event object is constructed in each Context thread 
- * before handed off; this maximizes compute in parallel listeners rather
- * than in bottlenecks like the stack manager thread.
+ * Only the cheap fields needed to pre-filter a request, such as method,
+ * extension number, and locality, are found in the constructor.  Lists,
+ * headers, nat source, authorization, and timestamps are decoded in groups
+ * on first access and then cached, so requests that are rejected early
+ * never pay for them.  Decoding is guarded so an event shared between the
+ * Context thread and the stack or database thread is parsed only once.
+ * The message body is a view into the exosip event rather than a copy,
+ * and must be deep copied if it is kept past the life of the event.
  * \author David Sugar <tychosoft@gmail.com>
  *
  * \fn Event::contacts()
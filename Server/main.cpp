@@ -113,6 +113,7 @@ int main(int argc, char **argv)
         {{"H", "host", "public"}, "Specify public host name", "host", "%%host"},
         {{"N", "network", "domain"}, "Specify network domain to serve", "name", "%%network"},
         {{"P", "port"}, "Specify network port to bind", "100-65534", "%%port"},
+        {{"W", "workers"}, "Specify context workers per schema", "1-64", "%%workers"},
         {Args::HelpArgument},
         {Args::VersionArgument},
         {{"c", "config"}, "Specify config file", "file", SERVICE_CONF},
@@ -150,10 +151,12 @@ int main(int argc, char **argv)
         {CURRENT_HOSTNAME,  "--host"},
         {CURRENT_PORT,      "--port"},
         {CURRENT_ADDRESS,   "--address"},
+        {CURRENT_WORKERS,   "--workers"},
         {DEFAULT_PORT,      5060},
         {DEFAULT_DATABASE,  "sqlite"},
         {DEFAULT_HOSTNAME,  QHostInfo::localHostName()},
         {DEFAULT_ADDRESS,   "any"},
+        {DEFAULT_WORKERS,   1},
         {DEFAULT_NETWORK,   Util::localDomain()},
     });
 
@@ -173,6 +176,10 @@ int main(int argc, char **argv)
     if(interfaces.count() < 1)
         crit(95) << "no valid interfaces specified";
 
+    unsigned workers = server[CURRENT_WORKERS].toUInt();
+    if(workers < 1 || workers > 64)
+        crit(95) << server[CURRENT_WORKERS] << ": invalid worker count";
+
     // create controller, load settings..
     auto zeroPort = port;
 
@@ -195,7 +202,7 @@ int main(int argc, char **argv)
 
     unsigned mask = Context::UDP | Context::TCP | Context::Allow::REGISTRY | Context::Allow::REMOTE;
 
-    Manager::create(interfaces, port, mask);
+    Manager::create(interfaces, port, mask, workers);
 
     // create managers and start server...
     Manager::init(2);
@@ -50,11 +50,13 @@
 #define CURRENT_HOSTNAME    "HOST"
 #define CURRENT_PORT        "PORT"
 #define CURRENT_DATABASE    "DATABASE"
+#define CURRENT_WORKERS     "WORKERS"
 #define DEFAULT_HOSTNAME    "host"
 #define DEFAULT_ADDRESS     "address"
 #define DEFAULT_NETWORK     "network"
 #define DEFAULT_PORT        "port"
 #define DEFAULT_DATABASE    "database"
+#define DEFAULT_WORKERS     "workers"
 
 class Main final : public QObject
 {
@@ -20,6 +20,9 @@
 #include "server.hpp"
 #include "output.hpp"
 #include "manager.hpp"
+#include "delivery.hpp"
+#include "overload.hpp"
+#include "admission.hpp"
 #include "zeroconf.hpp"
 #include "main.hpp"
 
@@ -37,6 +40,9 @@
 #include <QUuid>
 #include <QJsonObject>
 
+#define PRESENCE_TIMER 250l     // batch presence changes...
+#define DELIVERY_TIMER 10l      // pace queued messages...
+
 Manager *Manager::Instance = nullptr;
 UString Manager::ServerMode;
 UString Manager::ServerHostname;
@@ -47,12 +53,14 @@ QStringList Manager::ServerNames;
 std::atomic<unsigned> Manager::RosterSequence;
 unsigned Manager::Contexts = 0;
 
-Manager::Manager(unsigned order)
+Manager::Manager(unsigned order) :
+deliveryTimer(nullptr), scheduler(nullptr)
 {
     qRegisterMetaType<Event>("Event");
     qRegisterMetaType<UString>("UString");
 
     moveToThread(Server::createThread("stack", order));
+    scheduler = new Scheduler(thread(), "stack");
 #ifndef Q_OS_WIN
     osip_trace_initialize_syslog(TRACE_LEVEL0, const_cast<char *>("sipwitchqt"));
 #endif
@@ -80,7 +88,14 @@ void Manager::startup()
 {
     auto cleanupTimer = new QTimer(this);
     connect(cleanupTimer, &QTimer::timeout, this, &Manager::cleanup);
-    cleanupTimer->start(60000l);
+    cleanupTimer->start(1000l);
+
+    auto presenceTimer = new QTimer(this);
+    connect(presenceTimer, &QTimer::timeout, this, &Manager::publishPresence);
+    presenceTimer->start(PRESENCE_TIMER);
+
+    deliveryTimer = new QTimer(this);
+    connect(deliveryTimer, &QTimer::timeout, this, &Manager::advanceDelivery);
 }
 
 void Manager::cleanup()
@@ -88,6 +103,50 @@ void Manager::cleanup()
     Registry::cleanup();
 }
 
+// the delivery timer only runs while messages are scheduled, and only
+// it's tick sends, so each tick is held to one burst however many post...
+void Manager::startDelivery()
+{
+    if(deliveryTimer && Delivery::count() && !deliveryTimer->isActive())
+        deliveryTimer->start(DELIVERY_TIMER);
+}
+
+void Manager::advanceDelivery()
+{
+    Delivery::advance();
+    if(!Delivery::count())
+        deliveryTimer->stop();
+}
+
+// push coalesced presence deltas to active labeled clients
+void Manager::publishPresence()
+{
+    auto deltas = Registry::changes();
+    if(deltas.isEmpty())
+        return;
+
+    // paced with other messages by each endpoint's delivery queue...
+    auto posted = false;
+    foreach(auto reg, Registry::list()) {
+        if(!reg->isActive() || !reg->isLabeled())
+            continue;
+
+        QVariantHash data = {
+            {"c", QByteArray("text/presence")},
+            {"f", QByteArray("system")},
+            {"t", UString::number(reg->extension())},
+        };
+
+        foreach(auto delta, deltas) {
+            data["b"] = delta;
+            if(Delivery::post(reg->endpoint(), data))
+                posted = true;
+        }
+    }
+    if(posted)
+        startDelivery();
+}
+
 void Manager::applyNames()
 {
     QStringList names =  ServerAliases + ServerNames;
@@ -132,6 +191,11 @@ void Manager::applyConfig(const QVariantHash& config)
         info() << "entering realm " << ServerRealm;
         emit changeRealm(ServerRealm);
     }
+    Registry::setLifetime(config["nonce"].toInt());
+    Registry::setSigning(config["stateless"].toBool(), config["noncekey"].toByteArray());
+    Overload::configure(config);
+    Admission::configure(config);
+    Scheduler::configure(config);
     applyNames();
 }
 
@@ -143,23 +207,42 @@ const QByteArray Manager::computeDigest(const UString& id, const UString& secret
     return QCryptographicHash::hash(id + ":" + realm() + ":" + secret, digest);
 }
 
-void Manager::create(const QHostAddress& addr, quint16 port, unsigned mask)
+void Manager::create(const QHostAddress& addr, quint16 port, unsigned mask, unsigned workers)
 {
     unsigned index = ++Contexts;
 
     debug() << "Creating sip" << index << ": bind=" <<  addr.toString() << ", port=" << port << ", mask=" << QString("0x%1").arg(mask, 8, 16, QChar('0'));
 
     foreach(auto schema, Context::schemas()) {
-        if(schema.proto & mask) {
-            new Context(addr, port, schema, mask, index);
+        if(!(schema.proto & mask))
+            continue;
+
+        // schema specific worker count, such as [workers] udp = 4
+        auto count = Server::config("workers/" + schema.name).toUInt();
+        if(count < 1)
+            count = workers;
+        // our own reuseport socket is never set up by exosip for tls...
+        if(count > 1 && (schema.proto & (Context::TLS | Context::DTLS))) {
+            warning() << "sip" << index << "/" << schema.name << ": secure transport, using single worker";
+            count = 1;
+        }
+        if(count > 1 && !Context::isReusable()) {
+            warning() << "sip" << index << "/" << schema.name << ": no port reuse, using single worker";
+            count = 1;
+        }
+        if(count > 64)
+            count = 64;
+
+        for(unsigned worker = 0; worker < count; ++worker) {
+            new Context(addr, port, schema, mask, index, worker, count);
         }
     }
 }
 
-void Manager::create(const QList<QHostAddress>& list, quint16 port, unsigned  mask)
+void Manager::create(const QList<QHostAddress>& list, quint16 port, unsigned  mask, unsigned workers)
 {
     foreach(auto host, list) {
-        create(host, port, mask);
+        create(host, port, mask, workers);
     }
 }
 
@@ -171,55 +254,93 @@ void Manager::dropEndpoint(qlonglong endpoint)
 void Manager::sendMessage(qlonglong endpoint, const QVariantHash& data)
 {
     auto *reg = Registry::find(endpoint);
-    if(!reg || !reg->isActive()) {
+    if(!reg) {
         // will be queued in db only for now...
-        qDebug() << "endpoint inactive" << endpoint;
-        return;
-    }
-    auto context = reg->context();
-    UString type = data["c"].toByteArray();
-    UString from = data["f"].toByteArray();
-    UString to = data["t"].toByteArray();
-    UString route = context->prefix() + reg->route();
-    UString display = data["d"].toByteArray();
-    UString topic = data["s"].toByteArray();
-    UString label = reg->label();
-
-    if(label == "NONE" && type == "text/admin") {
-        type = "text/plain";
-        topic = "X-Admin";
-    }
-
-    if(label == "NONE" && type != "text/plain") {
+        qDebug() << "endpoint not registered" << endpoint;
         return;
     }
 
-    // adjusts message from and to based on registering entity delivery
-    // context-> message(registry, data)...
+    // paced, and held while inactive, by the endpoint's delivery queue...
+    if(Delivery::post(endpoint, data))
+        startDelivery();
+}
 
-    if(from.toInt() == reg->extension() || from == reg->user())
-        from = context->prefix() + UString::number(reg->extension()) + "@" + reg->origin();
-    else if(from.indexOf('@') < 1)
-        from = context->prefix() + from + "@" + reg->origin();
+void Manager::messageResponse(const QByteArray& mid, const QByteArray& endpoint, int status)
+{
+    Delivery::response(mid, endpoint.toLongLong(), status);
+    startDelivery();
+}
 
-    if(to.toInt() == reg->extension() || to == reg->user())
-        to = context->prefix() + UString::number(reg->extension()) + "@" + reg->origin();
-    else if(to.indexOf('@') < 1)
-        to = context->prefix() + to + "@" + reg->origin();
+// forward an authenticated request, from the stack or a context thread
+void Manager::accept(Action action, const Event& ev, const UString& user, qlonglong endpoint)
+{
+    auto manager = instance();
+    switch(action) {
+    case ROSTER:
+        emit manager->sendRoster(ev, endpoint);
+        break;
+    case PROFILE:
+        emit manager->changeProfile(ev, user, endpoint);
+        break;
+    case COVERAGE:
+        emit manager->changeCoverage(ev, user, endpoint);
+        break;
+    case FORWARDING:
+        emit manager->changeForwarding(ev, user, endpoint);
+        break;
+    case ADMIN:
+        emit manager->changeAdmin(ev, user, endpoint);
+        break;
+    case DROP:
+        emit manager->dropExtension(ev, user, endpoint);
+        break;
+    case MEMBERSHIP:
+        emit manager->changeMembership(ev, user, endpoint);
+        break;
+    case TOPIC:
+        emit manager->changeTopic(ev);
+        break;
+    case DEVLIST:
+        emit manager->sendDevlist(ev);
+        break;
+    case DEVKILL:
+        emit manager->removeDevice(ev, user, endpoint);
+        break;
+    case DEAUTHORIZE:
+        emit manager->removeAuthorize(ev);
+        break;
+    case AUTHORIZE:
+        emit manager->changeAuthorize(ev);
+        break;
+    case PENDING:
+        emit manager->sendPending(ev, endpoint);
+        break;
+    case ACK_PENDING:
+        Context::reply(ev, SIP_OK);
+        emit manager->changePending(ev, endpoint);
+        break;
+    }
+}
 
-    from = "\"" + display + "\" <" + from + ">";
-    to = "<" + to + ">";
+// challenge, or answer a failed challenge, for an extension request
+bool Manager::authenticated(const Event& ev, Registry *reg)
+{
+    if(!ev.authorization()) {
+        Context::challenge(ev, reg, true);
+        return false;
+    }
 
-    QList<QPair<UString,UString>> headers = {
-        {"Subject", topic},
-        {"X-MID", data["r"].toString()},
-        {"X-EP", QString::number(reg->endpoint())},
-        {"X-TS", data["p"].toDateTime().toString(Qt::ISODate)},
-        {"X-MS", data["u"].toString()},
-    };
+    auto result = reg->authenticate(ev);
+    if(result == SIP_UNAUTHORIZED) {
+        Context::challenge(ev, reg, false, true);
+        return false;
+    }
 
-    qDebug() << "Sending Message FROM" << from << "TO" << to << "VIA" << route;
-    context->message(from, to, route, headers, type, data["b"].toByteArray());
+    if(result != SIP_OK) {
+        Context::reply(ev, result);
+        return false;
+    }
+    return true;
 }
 
 void Manager::ackPending(const Event& ev)
@@ -234,18 +355,10 @@ void Manager::ackPending(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
-
-    Context::reply(ev, result);
-    emit changePending(reg->endpoint());
+    accept(ACK_PENDING, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestDeauthorize(const Event& ev)
@@ -260,17 +373,10 @@ void Manager::requestDeauthorize(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
-        return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    emit removeAuthorize(ev);
+    accept(DEAUTHORIZE, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestAuthorize(const Event& ev)
@@ -285,17 +391,10 @@ void Manager::requestAuthorize(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
 
-    emit changeAuthorize(ev);
+    accept(AUTHORIZE, ev, reg->user(), reg->endpoint());
 }
 
 
@@ -311,17 +410,10 @@ void Manager::requestPending(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
-        return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    emit sendPending(ev, reg->endpoint());
+    accept(PENDING, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestDevkill(const Event& ev)
@@ -336,17 +428,10 @@ void Manager::requestDevkill(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
-        return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    emit removeDevice(ev, reg->user(), reg->endpoint());
+    accept(DEVKILL, ev, reg->user(), reg->endpoint());
 }
 
 
@@ -362,17 +447,10 @@ void Manager::requestDevlist(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
-
-    emit sendDevlist(ev);
+    accept(DEVLIST, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestTopic(const Event& ev)
@@ -387,17 +465,10 @@ void Manager::requestTopic(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
-        return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    emit changeTopic(ev);
+    accept(TOPIC, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestForwarding(const Event& ev)
@@ -412,17 +483,10 @@ void Manager::requestForwarding(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
-
-    emit changeForwarding(ev, reg->user(), reg->endpoint());
+    accept(FORWARDING, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestCoverage(const Event& ev)
@@ -437,17 +501,10 @@ void Manager::requestCoverage(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
 
-    emit changeCoverage(ev, reg->user(), reg->endpoint());
+    accept(COVERAGE, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestDrop(const Event& ev)
@@ -462,17 +519,10 @@ void Manager::requestDrop(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
-
-    emit dropExtension(ev, reg->user(), reg->endpoint());
+    accept(DROP, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestAdmin(const Event& ev)
@@ -487,17 +537,10 @@ void Manager::requestAdmin(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
-
-    emit changeAdmin(ev, reg->user(), reg->endpoint());
+    accept(ADMIN, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestMembership(const Event& ev)
@@ -512,17 +555,10 @@ void Manager::requestMembership(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
-        return;
-    }
-
-    emit changeMembership(ev, reg->user(), reg->endpoint());
+    accept(MEMBERSHIP, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestProfile(const Event& ev)
@@ -537,17 +573,10 @@ void Manager::requestProfile(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
-        return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    emit changeProfile(ev, reg->user(), reg->endpoint());
+    accept(PROFILE, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::requestRoster(const Event& ev)
@@ -562,17 +591,10 @@ void Manager::requestRoster(const Event& ev)
         return;
     }
 
-    if(!ev.authorization()) {
-        Context::challenge(ev, reg, true);
-        return;
-    }
-
-    if(SIP_OK != (result = reg->authenticate(ev))) {
-        Context::reply(ev, result);
+    if(!authenticated(ev, reg))
         return;
-    }
 
-    emit sendRoster(ev, reg->endpoint());
+    accept(ROSTER, ev, reg->user(), reg->endpoint());
 }
 
 void Manager::refreshRegistration(const Event &ev)
@@ -600,10 +622,22 @@ void Manager::refreshRegistration(const Event &ev)
                     xdp += "r=" + UString::number(static_cast<int>(checkRoster())) + "\n";
                     xdp += "s=" + UString::number(Database::sequence()) + "\n";
                     xdp += "c=" + reg->route() + "\n";
-                    xdp += "a=" + Registry::bitmask() + "\n";
+                    xdp += "q=" + UString::number(Registry::sequence()) + "\n";
+                    // small plans keep the plain bitmap older clients expect
+                    auto bitmap = Registry::bitmask();
+                    if(bitmap.isEmpty())
+                        xdp += "o=" + Registry::presence() + "\n";
+                    else
+                        xdp += "a=" + bitmap + "\n";
                 }
                 Context::authorize(ev, reg, xdp);
+                if(!active && ev.expires() > 0) {
+                    Delivery::activate(reg->endpoint());
+                    startDelivery();
+                }
             }
+            else if(result == SIP_UNAUTHORIZED)
+                Context::challenge(ev, reg, false, true);
             else
                 Context::reply(ev, result);
             // releasing registration expires object
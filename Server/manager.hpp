@@ -21,7 +21,9 @@
 #include "../Common/compiler.hpp"
 #include "../Database/authorize.hpp"
 #include "invite.hpp"
+#include "scheduler.hpp"
 #include <QMutex>
+#include <QTimer>
 #include <QCryptographicHash>
 #include <atomic>
 
@@ -31,6 +33,12 @@ class Manager final : public QObject
     Q_DISABLE_COPY(Manager)
 
 public:
+    // authenticated extension requests forwarded for processing
+    enum Action : unsigned {
+        ROSTER, PROFILE, COVERAGE, FORWARDING, ADMIN, DROP, MEMBERSHIP,
+        TOPIC, DEVLIST, DEVKILL, DEAUTHORIZE, AUTHORIZE, PENDING, ACK_PENDING,
+    };
+
     inline static Manager *instance() {
         Q_ASSERT(Instance != nullptr);
         return Instance;
@@ -48,10 +56,15 @@ public:
         return RosterSequence.load(std::memory_order_acquire) % 8192;
     }
 
+    inline Scheduler *queues() const {
+        return scheduler;
+    }
+
     static const QByteArray computeDigest(const UString &id, const UString &secret, QCryptographicHash::Algorithm digest = QCryptographicHash::Md5);
-    static void create(const QList<QHostAddress>& list, quint16 port, unsigned mask);
-    static void create(const QHostAddress& addr, quint16 port, unsigned mask);
+    static void create(const QList<QHostAddress>& list, quint16 port, unsigned mask, unsigned workers = 1);
+    static void create(const QHostAddress& addr, quint16 port, unsigned mask, unsigned workers = 1);
     static void init(unsigned order);
+    static void accept(Action action, const Event& ev, const UString& user, qlonglong endpoint);
 
 private:
     static QStringList ServerAliases, ServerNames;
@@ -64,14 +77,20 @@ private:
     static QThread::Priority Priority;
     static std::atomic<unsigned> RosterSequence;
 
+    QTimer *deliveryTimer;
+    Scheduler *scheduler;
+
     void applyNames();
+    void startDelivery();
+
+    static bool authenticated(const Event& ev, Registry *reg);
 
     Manager(unsigned order = 0);
     ~Manager() final;
 
 signals:
     void changeRealm(const QString& realm);
-    void changePending(qlonglong endpoint);
+    void changePending(const Event& ev, qlonglong endpoint);
     void findEndpoint(const Event& ev);
     void sendRoster(const Event& ev, qlonglong endpoint);
     void sendDevlist(const Event& ev);
@@ -90,6 +109,7 @@ signals:
 
 public slots:
     void sendMessage(qlonglong endpoint, const QVariantHash& data);
+    void messageResponse(const QByteArray& mid, const QByteArray& endpoint, int status);
     void ackPending(const Event& ev);
     void requestTopic(const Event& ev);
     void requestRoster(const Event& ev);
@@ -113,6 +133,8 @@ public slots:
 private slots:
     void startup();
     void cleanup();
+    void publishPresence();
+    void advanceDelivery();
 };
 
 /*!
@@ -130,6 +152,12 @@ private slots:
  * to here as well.  By having a separate thread and event loop, and signaling
  * all actions through here (or the derived class), correct order and
  * synchronization of object and state changes is guaranteed without locking.
+ * Extension requests that a context thread can authenticate from the
+ * published registry snapshot are accepted there directly, and only those
+ * it cannot, or that change a registration, come through the stack.
+ * Messages to registered endpoints are paced and retried by Delivery.
+ * Requests from contexts and the database are routed thru a Scheduler, so
+ * that registrations are not held behind bursts of other requests.
  * \author David Sugar <tychosoft@gmail.com>
  */
 
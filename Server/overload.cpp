@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "event.hpp"
+#include "overload.hpp"
+
+#include <atomic>
+
+#define OVERLOAD_WATCH 4        // schedulers that may be watched...
+#define OVERLOAD_DELAY 2000     // default msecs a request may wait...
+#define OVERLOAD_RETRY 5        // default least seconds to retry after...
+
+namespace {
+std::atomic<Scheduler *> watched[OVERLOAD_WATCH];
+std::atomic<unsigned> limits[Scheduler::CLASSES];
+std::atomic<quint64> dropped[Scheduler::CLASSES];
+std::atomic<qint64> delay(OVERLOAD_DELAY);
+std::atomic<int> retry(OVERLOAD_RETRY);
+
+// registrations are shed last, as they are cheapest to answer...
+const unsigned defaults[Scheduler::CLASSES] = {1024, 512, 256};
+const char *keys[Scheduler::CLASSES] = {
+    "overload/registration", "overload/messaging", "overload/control",
+};
+
+// clients told to retry are spread over twice the least retry time
+int retryAfter()
+{
+    unsigned random = 0;
+    eXosip_generate_random(reinterpret_cast<char *>(&random), sizeof(random));
+    auto least = retry.load();
+    return least + static_cast<int>(random % static_cast<unsigned>(least + 1));
+}
+} // namespace
+
+void Overload::configure(const QVariantHash& config)
+{
+    for(unsigned priority = 0; priority < Scheduler::CLASSES; ++priority) {
+        auto value = config.value(keys[priority]);
+        limits[priority].store(value.isValid() ? value.toUInt() : defaults[priority]);
+    }
+
+    auto wait = config.value("overload/delay", OVERLOAD_DELAY).toLongLong();
+    delay.store(wait > 0 ? wait : 0);
+
+    auto least = config.value("overload/retry", OVERLOAD_RETRY).toInt();
+    retry.store(least > 0 ? least : 1);
+}
+
+void Overload::watch(Scheduler *scheduler)
+{
+    for(auto& slot : watched) {
+        Scheduler *empty = nullptr;
+        if(slot.compare_exchange_strong(empty, scheduler))
+            return;
+    }
+}
+
+void Overload::release(Scheduler *scheduler)
+{
+    for(auto& slot : watched) {
+        auto prior = scheduler;
+        slot.compare_exchange_strong(prior, nullptr);
+    }
+}
+
+int Overload::check(const Event& ev, Scheduler::Class priority)
+{
+    auto limit = limits[priority].load();
+    if(!limit)
+        return 0;
+
+    auto wait = delay.load();
+    auto behind = wait > 0 && ev.elapsed() > wait;
+    for(auto& slot : watched) {
+        auto scheduler = slot.load();
+        if(behind || !scheduler)
+            continue;
+        if(scheduler->depth(priority) > limit || (wait > 0 && scheduler->delay(priority) > wait))
+            behind = true;
+    }
+
+    if(!behind)
+        return 0;
+
+    dropped[priority].fetch_add(1);
+    return retryAfter();
+}
+
+quint64 Overload::shed(Scheduler::Class priority)
+{
+    return dropped[priority].load();
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OVERLOAD_HPP_
+#define OVERLOAD_HPP_
+
+#include "../Common/compiler.hpp"
+#include "scheduler.hpp"
+
+#include <QVariantHash>
+
+class Event;
+
+class Overload final
+{
+    Q_DISABLE_COPY(Overload)
+
+public:
+    static void configure(const QVariantHash& config);
+    static void watch(Scheduler *scheduler);
+    static void release(Scheduler *scheduler);
+    static int check(const Event& ev, Scheduler::Class priority);
+    static quint64 shed(Scheduler::Class priority);
+
+private:
+    Overload() = delete;
+};
+
+/*!
+ * Overload control for new requests.
+ * \file overload.hpp
+ */
+
+/*!
+ * \class Overload
+ * \brief Sheds new requests while the server is behind.
+ * Context threads check each new request against the queues of the stack
+ * and database schedulers before passing it on.  When the queue for the
+ * request's class is deeper than it's configured limit, or it's last task
+ * waited longer than the configured delay, or the request itself already
+ * waited that long in the context, the context answers 503 directly with
+ * a Retry-After randomized over a range, so clients retrying do not all
+ * come back at once.  Limits are set in the [overload] config section, and
+ * a limit of zero never sheds that class.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Overload::check(const Event& ev, Scheduler::Class priority)
+ * \param ev New request being considered.
+ * \param priority Class the request would be queued in.
+ * \return seconds to retry after if shed, else 0.
+ */
+
+#endif
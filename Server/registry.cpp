@@ -16,19 +16,39 @@
  */
 
 #include "manager.hpp"
+#include "delivery.hpp"
 
 #include <QMultiHash>
+#include <QSet>
+#include <QMessageAuthenticationCode>
+#include <QtEndian>
+#include <QTimer>
+#include <algorithm>
+#include <cctype>
+
+#define JOURNAL_BATCH 64         // changes per presence delta...
+#define NONCE_LIFETIME 600000l  // default nonce lifetime, 10 minutes...
+#define NONCE_WINDOW 32         // nonce counts accepted out of order...
+#define NONCE_SKEW 30l          // seconds a signed nonce may be ahead...
 
 namespace {
 QMultiHash<int, Registry*> extensions;
 QMultiHash<UString, Registry*> aliases;
 QHash<QPair<int,UString>, Registry *> registries;
 QHash<qlonglong, Registry *> endpoints;
-unsigned count[1000];
-unsigned char online[1000 / 8];
+QHash<int, unsigned> count;
+QHash<int, bool> journal;               // changes since last published
+quint32 published = 0;
+Presence online;
+TimerWheel expiries;
+std::shared_ptr<const Registry::Snapshot> current = std::make_shared<const Registry::Snapshot>();
+Registry::Snapshot::Shard staged[Registry::Snapshot::Shards];
+QSet<unsigned> dirty;                   // shards changed since published
+bool stale = false;
 bool init = false;
-QPair<int,int> range;
-int size = 0;
+std::atomic<qint64> lifetime(NONCE_LIFETIME);
+std::atomic<bool> stateless(false);
+std::shared_ptr<const QByteArray> signingKey = std::make_shared<const QByteArray>();
 
 QHash<UString, QCryptographicHash::Algorithm> digests = {
     {"MD5",     QCryptographicHash::Md5},
@@ -42,23 +62,183 @@ QHash<UString, QCryptographicHash::Algorithm> digests = {
     {"SHA-512", QCryptographicHash::Sha512},
 };
 
+// signed nonces are a timestamp and endpoint id, with a truncated hmac
+const int SIGNED_STAMP = 8;
+const int SIGNED_ENDPOINT = 8;
+const int SIGNED_MAC = 16;
+const int SIGNED_SIZE = SIGNED_STAMP + SIGNED_ENDPOINT + SIGNED_MAC;
+
+QByteArray sign(const QByteArray& data)
+{
+    auto key = std::atomic_load(&signingKey);
+    return QMessageAuthenticationCode::hash(data, *key, QCryptographicHash::Sha256).left(SIGNED_MAC);
+}
+
+// any worker, or any node sharing the key, can check a signed nonce
+int validate(const UString& once, qlonglong endpoint)
+{
+    auto nonce = QByteArray::fromHex(once);
+    if(nonce.size() != SIGNED_SIZE)
+        return SIP_FORBIDDEN;
+
+    auto data = nonce.left(SIGNED_STAMP + SIGNED_ENDPOINT);
+    auto mac = sign(data);
+    char diff = 0;
+    for(auto pos = 0; pos < SIGNED_MAC; ++pos)
+        diff |= mac[pos] ^ nonce[SIGNED_STAMP + SIGNED_ENDPOINT + pos];
+    if(diff)
+        return SIP_FORBIDDEN;
+
+    auto cp = reinterpret_cast<const uchar *>(data.constData());
+    if(qFromBigEndian<qint64>(cp + SIGNED_STAMP) != endpoint)
+        return SIP_FORBIDDEN;
+
+    auto issued = qFromBigEndian<qint64>(cp);
+    auto now = QDateTime::currentMSecsSinceEpoch() / 1000l;
+    if(issued > now + NONCE_SKEW || (now - issued) * 1000l >= lifetime.load())
+        return SIP_UNAUTHORIZED;
+
+    return SIP_OK;
+}
+
+// random or signed nonce, as we would have issued it
+bool wellformed(const UString& once)
+{
+    if(once.length() != 16 && once.length() != SIGNED_SIZE * 2)
+        return false;
+
+    for(auto ch : once) {
+        if(!isxdigit(static_cast<unsigned char>(ch)))
+            return false;
+    }
+    return true;
+}
+
+// digest check shared by the stack and context threads, with stale,
+// unknown, or rotated nonces and counts returning unauthorized so they
+// are challenged again
+int verify(const Event& ev, const UString& realm, const UString& id, const UString& algorithm, const UString& secret, qlonglong endpoint, const Nonce& current, const Nonce& prior)
+{
+    UString method = ev.method();
+    UString uri = ev.request();
+    UString once = ev.authorizingOnce();
+
+    if(ev.authorizingRealm() != realm)
+        return SIP_FORBIDDEN;
+
+    if(ev.authorizingId() != id)
+        return SIP_FORBIDDEN;
+
+    if(ev.authorizingAlgorithm() != algorithm)
+        return SIP_FORBIDDEN;
+
+    const Nonce *nonce = nullptr;
+    auto known = true;
+    if(!current.isEmpty() && once == current.text())
+        nonce = &current;
+    else if(!prior.isEmpty() && once == prior.text())
+        nonce = &prior;
+    else if(!wellformed(once))
+        return SIP_FORBIDDEN;
+    else
+        known = stateless.load() && validate(once, endpoint) == SIP_OK;
+
+    auto digest = digests.value(algorithm, QCryptographicHash::Md5);
+    auto qop = ev.authorizingQop();
+    UString ha2 = QCryptographicHash::hash(method + ":" + uri, digest).toHex().toLower();
+    UString expected;
+    if(qop.isEmpty())
+        expected = QCryptographicHash::hash(secret + ":" + once + ":" + ha2, digest).toHex().toLower();
+    else if(qop == "auth")
+        expected = QCryptographicHash::hash(secret + ":" + once + ":" + ev.authorizingCount() + ":" + ev.authorizingCnonce() + ":" + qop + ":" + ha2, digest).toHex().toLower();
+    else
+        return SIP_FORBIDDEN;
+
+    if(expected != ev.authorizingDigest())
+        return SIP_FORBIDDEN;
+
+    // a correct digest over a nonce we no longer hold is stale...
+    if(!known)
+        return SIP_UNAUTHORIZED;
+
+    // signed nonces not issued here are only bounded by their lifetime
+    if(!nonce)
+        return SIP_OK;
+
+    if(nonce->isExpired(expiries.elapsed(), lifetime.load()))
+        return SIP_UNAUTHORIZED;
+
+    // a re-used nonce count is challenged again with a fresh nonce...
+    if(!qop.isEmpty()) {
+        bool valid = false;
+        auto nc = ev.authorizingCount().toUInt(&valid, 16);
+        if(!valid)
+            return SIP_FORBIDDEN;
+        if(!nonce->count(nc))
+            return SIP_UNAUTHORIZED;
+    }
+
+    return SIP_OK;
+}
+
 void set(int number)
 {
-    number -= range.first;
-    auto offset = number / 8;
-    auto mask = static_cast<unsigned char>(1 << (number % 8));
-    online[offset] |= mask;
+    if(++count[number] == 1 && online.insert(number))
+        journal[number] = true;
 }
 
 void unset(int number)
 {
-    number -= range.first;
-    auto offset = number / 8;
-    auto mask = static_cast<unsigned char>(1 << (number % 8));
-    online[offset] &= ~mask;
+    if(--count[number] == 0) {
+        count.remove(number);
+        if(online.remove(number))
+            journal[number] = false;
+    }
 }
 } // namespace
 
+Registry::Snapshot::Snapshot()
+{
+    auto empty = std::make_shared<const Shard>();
+    for(auto& shard : shards)
+        shard = empty;
+}
+
+Nonce::Nonce(const QByteArray& value, qint64 created) :
+random(value), issued(created), seen(std::make_shared<std::atomic<quint64>>(0))
+{
+}
+
+// accept each nonce count once, allowing for some reordering
+bool Nonce::count(quint32 nc) const
+{
+    if(!seen || nc == 0)
+        return false;
+
+    auto prior = seen->load(std::memory_order_acquire);
+    quint64 next;
+    do {
+        auto highest = static_cast<quint32>(prior >> 32);
+        auto window = static_cast<quint32>(prior);
+        if(nc > highest) {
+            auto shift = nc - highest;
+            if(highest == 0 || shift > NONCE_WINDOW)
+                window = 0;
+            else
+                window = static_cast<quint32>((static_cast<quint64>(window) << shift) | (1ull << (shift - 1)));
+            highest = nc;
+        }
+        else {
+            auto behind = highest - nc - 1;
+            if(nc == highest || behind >= NONCE_WINDOW || (window & (1u << behind)))
+                return false;
+            window |= 1u << behind;
+        }
+        next = (static_cast<quint64>(highest) << 32) | window;
+    } while(!seen->compare_exchange_weak(prior, next, std::memory_order_acq_rel));
+    return true;
+}
+
 // We create registration records based on the initial pre-authorize
 // request, and as inactive.  The registration becomes active only when
 // it is updated by an authorized request.
@@ -66,9 +246,8 @@ Registry::Registry(const QVariantHash &ep) :
 active(false), timeout(-1), serverContext(nullptr)
 {    
     if(!init) {
-        range = Database::range();
-        size = ((range.second - range.first) / 8) + 1;
-        memset(count, 0, sizeof(count));
+        auto range = Database::range();
+        online.reset(range.first, range.second);
         init = true;
     }
 
@@ -85,15 +264,16 @@ active(false), timeout(-1), serverContext(nullptr)
     endpointId = ep.value("endpoint").toLongLong();
 
     updated.start();
+    schedule();
 
-    if(++count[number] == 1)
-        set(number);
+    set(number);
 
     QPair<int,UString> key(number, userLabel);
     extensions.insert(number, this);
     aliases.insert(userId, this);
     registries.insert(key, this);
     endpoints.insert(endpointId, this);
+    update();
     qDebug() << "Initializing" << key;
 }
 
@@ -106,33 +286,209 @@ Registry::~Registry()
         // may later kill active calls, etc...
     }
 
-    if(--count[number] == 0) {
-        unset(number);
-    }
+    unset(number);
+    Delivery::remove(endpointId);       // nothing left to deliver to...
 
     QPair<int,UString> key(number, userLabel);
     endpoints.remove(endpointId);
     registries.remove(key);
     extensions.remove(number, this);
     aliases.remove(userId, this);
+    changed(key, nullptr);
 }
 
-void Registry::cleanup()
+void Registry::update()
+{
+    auto entry = std::make_shared<Entry>();
+    entry->user = userId;
+    entry->label = userLabel;
+    entry->realm = authRealm;
+    entry->digest = authDigest;
+    entry->secret = userSecret;
+    entry->nonce = random;
+    entry->prior = prior;
+    entry->endpoint = endpointId;
+    entry->number = number;
+    entry->context = serverContext;
+    entry->expires = -1;
+    if(timeout > -1)
+        entry->expires = expiries.elapsed() - updated.elapsed() + timeout;
+    entry->active = active;
+    view = entry;
+    changed({number, userLabel}, view);
+}
+
+// staged in it's shard, and published once the stack is done with the
+// events now in hand
+void Registry::changed(const Snapshot::Key& key, const std::shared_ptr<const Entry>& entry)
+{
+    auto shard = Snapshot::shard(key);
+    if(entry)
+        staged[shard].insert(key, entry);
+    else
+        staged[shard].remove(key);
+    dirty.insert(shard);
+
+    if(stale)
+        return;
+
+    stale = true;
+    QTimer::singleShot(0, Manager::instance(), &Registry::publish);
+}
+
+// unchanged shards are shared with the prior snapshot, and changed ones
+// share their staged hash until it is next changed
+void Registry::publish()
+{
+    auto snapshot = std::make_shared<Snapshot>(*std::atomic_load(&current));
+    foreach(auto shard, dirty)
+        snapshot->shards[shard] = std::make_shared<const Snapshot::Shard>(staged[shard]);
+
+    dirty.clear();
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(snapshot));
+    stale = false;
+}
+
+void Registry::setLifetime(int seconds)
+{
+    if(seconds > 0)
+        lifetime.store(seconds * 1000l);
+}
+
+// an empty key generates a private one, good only for this server
+void Registry::setSigning(bool enable, const QByteArray& key)
+{
+    auto secret = key;
+    if(enable && secret.isEmpty())
+        secret = *std::atomic_load(&signingKey);    // keep nonces valid on reload
+
+    if(enable && secret.isEmpty()) {
+        char buf[32];
+        eXosip_generate_random(buf, sizeof(buf));
+        secret = QByteArray(buf, sizeof(buf));
+    }
+    std::atomic_store(&signingKey, std::make_shared<const QByteArray>(secret));
+    stateless.store(enable);
+}
+
+QByteArray Registry::createNonce(qlonglong endpoint)
 {
-    auto snapshot = registries;
-    foreach(auto reg, snapshot) {
-        if(reg->hasExpired())
-            delete reg;
+    if(!stateless.load()) {
+        char buf[8];
+        eXosip_generate_random(buf, sizeof(buf));
+        return QByteArray(buf, sizeof(buf));
     }
+
+    QByteArray data(SIGNED_STAMP + SIGNED_ENDPOINT, 0);
+    auto cp = reinterpret_cast<uchar *>(data.data());
+    qToBigEndian<qint64>(QDateTime::currentMSecsSinceEpoch() / 1000l, cp);
+    qToBigEndian<qint64>(endpoint, cp + SIGNED_STAMP);
+    return data + sign(data);
+}
+
+// a nonce past it's lifetime is not offered again
+QByteArray Registry::nounce() const
+{
+    if(random.isExpired(expiries.elapsed(), lifetime.load()))
+        return QByteArray();
+    return random.value();
+}
+
+void Registry::setNounce(const QByteArray& value)
+{
+    prior = random;
+    random = Nonce(value, expiries.elapsed());
+    update();
+}
+
+std::shared_ptr<const Registry::Snapshot> Registry::snapshot()
+{
+    return std::atomic_load(&current);
+}
+
+// authenticating a challenge from a context thread
+int Registry::authenticate(const Entry& entry, const Event& ev)
+{
+    if(!entry.active || !entry.context)
+        return SIP_TEMPORARILY_UNAVAILABLE;
+
+    if(entry.expires > -1 && expiries.elapsed() >= entry.expires)
+        return SIP_TEMPORARILY_UNAVAILABLE;
+
+    // following an endpoint to a sibling worker changes the registration
+    auto context = ev.context();
+    if(context != entry.context && entry.context->isSibling(context))
+        return SIP_TEMPORARILY_UNAVAILABLE;
+
+    return verify(ev, entry.realm, entry.user, entry.digest, entry.secret, entry.endpoint, entry.nonce, entry.prior);
+}
+
+// keep the wheel at the current expiration of the record
+void Registry::schedule()
+{
+    if(timeout < 0)
+        expiries.cancel(this);
+    else
+        expiries.schedule(this, expiries.elapsed() + timeout);
+}
+
+void Registry::expired()
+{
+    if(hasExpired())
+        delete this;
+    else
+        schedule();
+}
+
+void Registry::cleanup()
+{
+    auto expired = expiries.advance();
+    if(expired)
+        qDebug() << "Expired" << expired << "registrations," << expiries.count() << "remaining";
 }
 
 UString Registry::bitmask()
 {
-    if(size < 1)
-        return UString();
+    return online.bitmap();
+}
+
+UString Registry::presence()
+{
+    return online.encoded();
+}
 
-    QByteArray result(reinterpret_cast<const char *>(&online), size);
-    return result.toBase64();
+quint32 Registry::sequence()
+{
+    return published;
+}
+
+// coalesced changes as numbered deltas of absolute states, so that a
+// delta may safely be applied over a map that already includes it.
+QList<UString> Registry::changes()
+{
+    QList<UString> deltas;
+    if(journal.isEmpty())
+        return deltas;
+
+    auto numbers = journal.keys();
+    std::sort(numbers.begin(), numbers.end());
+    for(auto pos = 0; pos < numbers.count(); pos += JOURNAL_BATCH) {
+        UString on, off;
+        foreach(auto number, numbers.mid(pos, JOURNAL_BATCH)) {
+            auto& list = journal[number] ? on : off;
+            if(!list.isEmpty())
+                list += ",";
+            list += UString::number(number);
+        }
+        UString delta = "q=" + UString::number(++published) + "\n";
+        if(!on.isEmpty())
+            delta += "n=" + on + "\n";
+        if(!off.isEmpty())
+            delta += "x=" + off + "\n";
+        deltas << delta;
+    }
+    journal.clear();
+    return deltas;
 }
 
 QList<Registry *> Registry::list()
@@ -151,6 +507,16 @@ Registry *Registry::find(qlonglong key)
     return reg;
 }
 
+// an active registration, without releasing an expired one, for those
+// whose own state is released with it
+Registry *Registry::findActive(qlonglong key)
+{
+    auto *reg = endpoints.value(key, nullptr);
+    if(!reg || !reg->isActive() || reg->hasExpired())
+        return nullptr;
+    return reg;
+}
+
 // to find a registration record associated with a registration event
 Registry *Registry::find(const Event& event)
 {
@@ -183,32 +549,19 @@ QList<Registry *> Registry::find(const UString& target)
 // authenticating a challenge
 int Registry::authenticate(const Event& ev)
 {
-    UString nonce = random.toHex().toLower();
-    UString ponce = prior.toHex().toLower();
-    UString method = ev.method();
-    UString uri = ev.request();
-
     if(hasExpired() || !serverContext)
         return SIP_TEMPORARILY_UNAVAILABLE;
 
-    if(ev.authorizingRealm() != authRealm)
-        return SIP_FORBIDDEN;
-
-    if(ev.authorizingId() != userId)
-        return SIP_FORBIDDEN;
-
-    if(ev.authorizingAlgorithm() != authDigest)
-        return SIP_FORBIDDEN;
+    auto result = verify(ev, authRealm, userId, authDigest, userSecret, endpointId, random, prior);
+    if(result != SIP_OK)
+        return result;
 
-    if(ev.authorizingOnce() != nonce && ev.authorizingOnce() != ponce)
-        return SIP_FORBIDDEN;
-
-    auto digest = digests[authDigest];
-    UString ha2 = QCryptographicHash::hash(method + ":" + uri, digest).toHex().toLower();
-    UString expected = QCryptographicHash::hash(userSecret + ":" + ev.authorizingOnce() + ":" + ha2, digest).toHex().toLower();
-
-    if(expected != ev.authorizingDigest())
-        return SIP_FORBIDDEN;
+    // follow endpoint to the sibling worker that now carries its traffic
+    auto context = ev.context();
+    if(context != serverContext && serverContext->isSibling(context)) {
+        serverContext = context;
+        update();
+    }
 
     return SIP_OK;
 }
@@ -216,34 +569,21 @@ int Registry::authenticate(const Event& ev)
 // authorize registration processing
 int Registry::authorize(const Event& ev)
 {
-    UString nonce = random.toHex().toLower();
-    UString method = ev.method();
-    UString uri = ev.request();
+    // refreshes may carry the nonce a challenge just rotated out, and a
+    // stale nonce keeps the registration while it is challenged again
+    auto result = verify(ev, authRealm, userId, authDigest, userSecret, endpointId, random, prior);
+    if(result == SIP_UNAUTHORIZED)
+        return result;
 
     active = false;
-
-    if(ev.authorizingRealm() != authRealm)
-        return SIP_FORBIDDEN;
-
-    if(ev.authorizingId() != userId)
-        return SIP_FORBIDDEN;
-
-    if(ev.authorizingAlgorithm() != authDigest)
-        return SIP_FORBIDDEN;
-
-    if(ev.authorizingOnce() != nonce)
-        return SIP_FORBIDDEN;
-
-    auto digest = digests[authDigest];
-    UString ha2 = QCryptographicHash::hash(method + ":" + uri, digest).toHex().toLower();
-    UString expected = QCryptographicHash::hash(userSecret + ":" + nonce + ":" + ha2, digest).toHex().toLower();
-
-    if(expected != ev.authorizingDigest())
-        return SIP_FORBIDDEN;
+    if(result != SIP_OK)
+        return result;
 
     // de-registration
     if(ev.expires() < 1) {
         timeout = 0;
+        schedule();
+        update();
         qDebug() << "De-registering" << ev.number() << ev.label();
         return SIP_OK;
     }
@@ -262,7 +602,9 @@ int Registry::authorize(const Event& ev)
         address = ev.contact();
     serverContext = ev.context();
     updated.restart();
+    schedule();
     active = true;
+    update();
 
     //some testing for core message code...
     //context->message("system", UString::number(number), address.toString(), {{"Subject", "Hello World"}});
@@ -20,21 +20,92 @@
 
 #include "../Common/compiler.hpp"
 #include "context.hpp"
+#include "timerwheel.hpp"
+#include "../Common/presence.hpp"
 
 #include <QSqlRecord>
 #include <QElapsedTimer>
+#include <memory>
+#include <atomic>
 
 class LocalSegment;
 class Registry;
 class Event;
 
-class Registry final
+// a digest challenge nonce, shared by all copies of a registration
+class Nonce final
+{
+public:
+    Nonce() : issued(-1) {}
+    Nonce(const QByteArray& random, qint64 created);
+
+    inline const QByteArray value() const {
+        return random;
+    }
+
+    inline const UString text() const {
+        return random.toHex().toLower();
+    }
+
+    inline bool isEmpty() const {
+        return random.isEmpty();
+    }
+
+    inline bool isExpired(qint64 now, qint64 lifetime) const {
+        return issued < 0 || now - issued >= lifetime;
+    }
+
+    bool count(quint32 nc) const;
+
+private:
+    QByteArray random;
+    qint64 issued;                                  // on registry clock
+    std::shared_ptr<std::atomic<quint64>> seen;     // highest nc, window
+};
+
+class Registry final : public TimerWheel::Timer
 {
     Q_DISABLE_COPY(Registry)
 
 public:
+    // immutable copy of a registration, for context threads
+    using Entry = struct {
+        UString user, label, realm, digest, secret;
+        Nonce nonce, prior;
+        qlonglong endpoint;
+        int number;
+        Context *context;
+        qint64 expires;                 // deadline on registry clock, or -1
+        bool active;
+    };
+
+    // published registrations, copied only a shard at a time as they change
+    class Snapshot final
+    {
+    public:
+        using Key = QPair<int,UString>;
+        using Shard = QHash<Key, std::shared_ptr<const Entry>>;
+
+        static const unsigned Shards = 64;
+
+        Snapshot();
+
+        inline std::shared_ptr<const Entry> value(const Key& key) const {
+            return shards[shard(key)]->value(key);
+        }
+
+        inline static unsigned shard(const Key& key) {
+            return qHash(key) % Shards;
+        }
+
+    private:
+        friend class Registry;
+
+        std::shared_ptr<const Shard> shards[Shards];
+    };
+
     Registry(const QVariantHash& ep);
-    ~Registry();
+    ~Registry() final;
 
     const UString display() const {
         return userDisplay;
@@ -110,26 +181,30 @@ public:
         return !userLabel.isEmpty() && userLabel != "NONE";
     }
 
-    QByteArray nounce() const {
-        return random;
-    }
-
-    void setNounce(const QByteArray& value) {
-        prior = random;
-        random = value;
-    }
+    QByteArray nounce() const;
+    void setNounce(const QByteArray& value);
 
     int authorize(const Event& event);
     int authenticate(const Event& event);
 
     static Registry *find(const Event& event);      // to find registration
     static Registry *find(qlonglong);
+    static Registry *findActive(qlonglong endpoint);
     static QList<Registry *> find(const UString& target);
     static QList<Registry *> list();
     static UString bitmask();
+    static UString presence();
+    static quint32 sequence();
+    static QList<UString> changes();
 
     static void cleanup();
 
+    static std::shared_ptr<const Snapshot> snapshot();
+    static int authenticate(const Entry& entry, const Event& event);
+    static void setLifetime(int seconds);
+    static void setSigning(bool enable, const QByteArray& key = QByteArray());
+    static QByteArray createNonce(qlonglong endpoint);
+
 private:
     UString userId, userLabel, userSecret, authRealm, authDigest;
     UString userDisplay, userAgent, userOrigin, userPrivs;
@@ -137,12 +212,20 @@ private:
     bool active;
     qlonglong endpointId;               // endpoint id from database
     qint64 timeout;                     // time till expires
-    QByteArray random, prior;           // nounce value
+    Nonce random, prior;                // nounce values
     Context *serverContext;             // context of endpoint
     Contact address;                    // contact record for endpoint
     QElapsedTimer updated;              // when the record was updated
     QList<LocalSegment *> calls;        // local calls on this endpoint
     QList<UString> allows;
+    std::shared_ptr<const Entry> view;  // published form of the record
+
+    void schedule();
+    void update();
+    void expired() final;
+
+    static void changed(const Snapshot::Key& key, const std::shared_ptr<const Entry>& entry);
+    static void publish();
 };
 
 QDebug operator<<(QDebug dbg, const Registry& registry);
@@ -155,11 +238,44 @@ QDebug operator<<(QDebug dbg, const Registry& registry);
  * \file registry.hpp
  */
 
+/*!
+ * \class Nonce
+ * \brief A digest challenge nonce.
+ * Nonces are issued with a configurable lifetime, after which a request
+ * is challenged again as stale.  When a client authenticates with
+ * qop=auth, each nonce count may be used only once.  Counts are tracked as
+ * the highest seen and a 32 count window behind it, so that requests that
+ * arrive slightly out of order are still accepted.  The count is shared
+ * by every copy of a nonce, including those in published snapshots.
+ *
+ * Nonces may optionally be signed rather than random.  A signed nonce
+ * carries the time it was issued and the endpoint it was issued to,
+ * authenticated by a truncated HMAC-SHA256 under a server key.  Any
+ * context worker, or another server sharing the key, can then accept it
+ * without having seen the challenge, and freshness is bounded by the
+ * nonce lifetime rather than by stored values.  Counts are still checked
+ * for the nonces a registration was issued locally.
+ * \author David Sugar <tychosoft@gmail.com>
+ */
+
 /*!
  * \class Registry
  * \brief An active registration.
  * A registration consists of a user endpoints that is registered
- * thru the stack which are associated with that user.
+ * thru the stack which are associated with that user.  Each registration
+ * is kept on a timer wheel by it's expiration, which the stack advances
+ * every second, so that expired registrations are released, and the
+ * online bitmap updated, without scanning every registration.
+ *
+ * Context threads may not touch registrations, which are owned by the
+ * stack.  Instead the stack publishes an immutable snapshot of them,
+ * and context threads take a reference to the current snapshot to
+ * authenticate requests in parallel.  A snapshot is split into shards by
+ * registration, and after a change only the shards that were changed are
+ * copied into the next snapshot, which shares the rest with the one before
+ * it, so that a registration storm does not copy every registration on
+ * each publish.  A snapshot is released when it's last reader is done
+ * with it.
  * \author David Sugar <tychosoft@gmail.com>
  */
 
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.hpp"
+#include "overload.hpp"
+#include "scheduler.hpp"
+
+#include <QMutexLocker>
+#include <QCoreApplication>
+
+#define SCHEDULER_BATCH 16      // tasks per drain before yielding...
+#define SCHEDULER_REPORT 60000  // msecs between queue statistics...
+#define SCHEDULER_RING 1024     // tasks held lock-free per class, power of 2...
+
+namespace {
+enum {
+    // scheduler events...
+    TASK_EVENT = QEvent::User + 1,
+};
+
+class TaskEvent final : public QEvent
+{
+    Q_DISABLE_COPY(TaskEvent)
+public:
+    TaskEvent(unsigned priority, const std::function<void()>& task, qint64 queued) :
+    QEvent(static_cast<QEvent::Type>(TASK_EVENT)), taskClass(priority), taskRun(task), taskQueued(queued) {}
+
+    ~TaskEvent() final;
+
+    unsigned priority() const {
+        return taskClass;
+    }
+
+    qint64 queued() const {
+        return taskQueued;
+    }
+
+    void run() const {
+        taskRun();
+    }
+
+private:
+    unsigned taskClass;
+    std::function<void()> taskRun;
+    qint64 taskQueued;
+};
+
+TaskEvent::~TaskEvent() = default;
+
+std::atomic<bool> rings(true);
+} // namespace
+
+Scheduler::Scheduler(QThread *thread, const QString& name) :
+pending(false), current(0), credit(0), reporter(nullptr), reported(0)
+{
+    setObjectName(name);
+    for(unsigned priority = 0; priority < CLASSES; ++priority) {
+        auto& queue = queues[priority];
+        queue.ring = new Cell[SCHEDULER_RING];
+        for(quint64 pos = 0; pos < SCHEDULER_RING; ++pos)
+            queue.ring[pos].sequence.store(pos);
+        queue.tail.store(0);
+        queue.head = 0;
+        queue.overflowed.store(0);
+        queue.highest.store(0);
+        queue.processed.store(0);
+        queue.fallbacks.store(0);
+        queue.posting.store(0);
+        queue.waiting.store(0);
+        depths[priority].store(0);
+        delays[priority].store(0);
+    }
+    clock.start();
+
+    queues[REGISTRATION].weight.store(4);
+    queues[MESSAGING].weight.store(2);
+    queues[CONTROL].weight.store(1);
+
+    moveToThread(thread);
+    connect(thread, &QThread::finished, this, &QObject::deleteLater);
+    Overload::watch(this);
+}
+
+Scheduler::~Scheduler()
+{
+    Overload::release(this);
+    for(auto& queue : queues)
+        delete[] queue.ring;
+}
+
+void Scheduler::configure(const QVariantHash& config)
+{
+    rings.store(config.value("scheduler/rings", true).toBool());
+}
+
+void Scheduler::setWeight(Class priority, unsigned weight)
+{
+    Q_ASSERT(priority < CLASSES);
+    queues[priority].weight.store(weight ? weight : 1);
+}
+
+const Scheduler::Stats Scheduler::stats(Class priority) const
+{
+    Q_ASSERT(priority < CLASSES);
+    const auto& queue = queues[priority];
+    auto processed = queue.processed.load();
+    auto posted = processed + depth(priority);
+    auto posting = posted ? static_cast<qint64>(queue.posting.load() / posted) : 0;
+    auto waiting = processed ? static_cast<qint64>(queue.waiting.load() / processed) : 0;
+    return {depth(priority), queue.highest.load(), processed, queue.fallbacks.load(), posting, waiting};
+}
+
+void Scheduler::post(Class priority, const std::function<void()>& task)
+{
+    Q_ASSERT(priority < CLASSES);
+    auto& queue = queues[priority];
+    auto started = clock.nsecsElapsed();
+    Task item = {task, started};
+
+    auto count = depths[priority].fetch_add(1, std::memory_order_relaxed) + 1;
+    auto highest = queue.highest.load(std::memory_order_relaxed);
+    while(count > highest && !queue.highest.compare_exchange_weak(highest, count, std::memory_order_relaxed))
+        ;
+
+    // the qt path, one posted event per task, as a queued signal...
+    if(!rings.load(std::memory_order_relaxed)) {
+        queue.fallbacks.fetch_add(1, std::memory_order_relaxed);
+        QCoreApplication::postEvent(this, new TaskEvent(priority, task, started));
+        queue.posting.fetch_add(static_cast<quint64>(clock.nsecsElapsed() - started), std::memory_order_relaxed);
+        return;
+    }
+
+    if(!push(queue, item)) {
+        QMutexLocker locker(&lock);
+        queue.overflow.enqueue(item);
+        queue.overflowed.fetch_add(1);
+        queue.fallbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if(!pending.exchange(true))
+        QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+    queue.posting.fetch_add(static_cast<quint64>(clock.nsecsElapsed() - started), std::memory_order_relaxed);
+}
+
+// claim a cell by position, then publish it once the task is stored
+bool Scheduler::push(Queue& queue, Task& task)
+{
+    if(queue.overflowed.load())
+        return false;
+
+    auto pos = queue.tail.load(std::memory_order_relaxed);
+    for(;;) {
+        auto& cell = queue.ring[pos & (SCHEDULER_RING - 1)];
+        auto sequence = cell.sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<qint64>(sequence - pos);
+        if(diff < 0)
+            return false;
+        if(diff > 0) {
+            pos = queue.tail.load(std::memory_order_relaxed);
+            continue;
+        }
+        if(queue.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+    }
+
+    auto& cell = queue.ring[pos & (SCHEDULER_RING - 1)];
+    cell.task = std::move(task);
+    cell.sequence.store(pos + 1);
+    return true;
+}
+
+// ring first, as anything posted to it is older than what overflowed
+bool Scheduler::take(Queue& queue, Task& task)
+{
+    auto& cell = queue.ring[queue.head & (SCHEDULER_RING - 1)];
+    if(cell.sequence.load() == queue.head + 1) {
+        task = std::move(cell.task);
+        cell.task.run = nullptr;
+        cell.sequence.store(queue.head + SCHEDULER_RING, std::memory_order_release);
+        ++queue.head;
+        return true;
+    }
+
+    // a cell claimed but not yet published is older than the overflow
+    if(!queue.overflowed.load() || queue.tail.load() != queue.head)
+        return false;
+
+    QMutexLocker locker(&lock);
+    if(queue.overflow.isEmpty())
+        return false;
+    task = queue.overflow.dequeue();
+    queue.overflowed.fetch_sub(1);
+    return true;
+}
+
+bool Scheduler::ready()
+{
+    for(auto& queue : queues) {
+        if(queue.ring[queue.head & (SCHEDULER_RING - 1)].sequence.load() == queue.head + 1)
+            return true;
+        if(queue.overflowed.load() && queue.tail.load() == queue.head)
+            return true;
+    }
+    return false;
+}
+
+// weighted round robin, each class spends it's credit before the next...
+bool Scheduler::next(std::function<void()>& task)
+{
+    for(unsigned tries = 0; tries <= CLASSES; ++tries) {
+        auto& queue = queues[current];
+        Task item;
+        if(credit && take(queue, item)) {
+            --credit;
+            account(current, item.queued);
+            task = std::move(item.run);
+            return true;
+        }
+        current = (current + 1) % CLASSES;
+        credit = queues[current].weight.load(std::memory_order_relaxed);
+    }
+    return false;
+}
+
+// started from our own thread, by the first task to run in it
+void Scheduler::reporting()
+{
+    if(reporter)
+        return;
+
+    reporter = new QTimer(this);
+    connect(reporter, &QTimer::timeout, this, &Scheduler::report);
+    reporter->start(SCHEDULER_REPORT);
+}
+
+void Scheduler::account(unsigned priority, qint64 queued)
+{
+    auto& queue = queues[priority];
+    auto waited = clock.nsecsElapsed() - queued;
+    queue.processed.fetch_add(1, std::memory_order_relaxed);
+    queue.waiting.fetch_add(static_cast<quint64>(waited), std::memory_order_relaxed);
+    depths[priority].fetch_sub(1, std::memory_order_relaxed);
+    delays[priority].store(waited / 1000000, std::memory_order_relaxed);
+}
+
+bool Scheduler::event(QEvent *evt)
+{
+    if(static_cast<int>(evt->type()) != TASK_EVENT)
+        return QObject::event(evt);
+
+    reporting();
+    auto task = static_cast<TaskEvent *>(evt);
+    account(task->priority(), task->queued());
+    task->run();
+    return true;
+}
+
+void Scheduler::drain()
+{
+    reporting();
+    for(unsigned count = 0; count < SCHEDULER_BATCH; ++count) {
+        std::function<void()> task;
+        if(!next(task)) {
+            // a post racing with us may have seen us still pending
+            pending.store(false);
+            if(!ready() || pending.exchange(true))
+                return;
+            continue;
+        }
+        task();
+    }
+
+    // yield to other events of our thread, and resume after them
+    QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+}
+
+void Scheduler::report()
+{
+    static const char *names[CLASSES] = {"registration", "messaging", "control"};
+
+    quint64 total = 0;
+    for(const auto& queue : queues)
+        total += queue.processed.load(std::memory_order_relaxed);
+    if(total == reported)
+        return;
+
+    reported = total;
+    for(unsigned priority = 0; priority < CLASSES; ++priority) {
+        auto stats = this->stats(static_cast<Class>(priority));
+        debug() << objectName() << ": " << names[priority] << " depth=" << stats.depth << ", highest=" << stats.highest << ", processed=" << stats.processed << ", fallback=" << stats.fallbacks << ", post=" << stats.posting << "ns, wait=" << stats.waiting << "ns, shed=" << Overload::shed(static_cast<Class>(priority));
+    }
+}
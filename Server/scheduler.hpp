@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCHEDULER_HPP_
+#define SCHEDULER_HPP_
+
+#include "../Common/compiler.hpp"
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QQueue>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVariantHash>
+#include <functional>
+#include <atomic>
+
+class Scheduler final : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(Scheduler)
+
+public:
+    enum Class : unsigned {
+        REGISTRATION, MESSAGING, CONTROL, CLASSES,
+    };
+
+    using Stats = struct {
+        unsigned depth, highest;        // queued now, and most queued
+        quint64 processed;
+        quint64 fallbacks;              // posted under lock or as qt events
+        qint64 posting, waiting;        // average nsecs to post, and queued
+    };
+
+    Scheduler(QThread *thread, const QString& name);
+    ~Scheduler() final;
+
+    inline unsigned depth(Class priority) const {
+        return depths[priority].load(std::memory_order_relaxed);
+    }
+
+    // msecs the last task of a class waited, while others are queued
+    inline qint64 delay(Class priority) const {
+        return depth(priority) ? delays[priority].load(std::memory_order_relaxed) : 0;
+    }
+
+    void post(Class priority, const std::function<void()>& task);
+    void setWeight(Class priority, unsigned weight);
+    const Stats stats(Class priority) const;
+
+    static void configure(const QVariantHash& config);
+
+    // route a signal thru a priority queue to a slot in our thread
+    template<class Sender, typename... Signal, class Receiver, typename... Slot>
+    void route(Sender *sender, void (Sender::*signal)(Signal...), Receiver *receiver, void (Receiver::*slot)(Slot...), Class priority) {
+        connect(sender, signal, this, [this, receiver, slot, priority](Signal... args) {
+            post(priority, [=]() {
+                (receiver->*slot)(args...);
+            });
+        }, Qt::DirectConnection);
+    }
+
+private:
+    using Task = struct {
+        std::function<void()> run;
+        qint64 queued;                  // nsecs on scheduler clock
+    };
+
+    using Cell = struct {
+        std::atomic<quint64> sequence;  // position it's ready to be
+        Task task;
+    };
+
+    using Queue = struct {
+        Cell *ring;                     // lock-free, many posters, one drain
+        std::atomic<quint64> tail;      // next claimed by posters
+        quint64 head;                   // next taken by drain
+        QQueue<Task> overflow;          // under lock, when ring is full
+        std::atomic<unsigned> overflowed;
+        std::atomic<unsigned> weight;   // tasks per round
+        std::atomic<unsigned> highest;
+        std::atomic<quint64> processed, fallbacks;
+        std::atomic<quint64> posting, waiting;  // total nsecs
+    };
+
+    mutable QMutex lock;                // only for overflow
+    Queue queues[CLASSES];
+    std::atomic<unsigned> depths[CLASSES];  // read by any thread
+    std::atomic<qint64> delays[CLASSES];
+    std::atomic<bool> pending;          // drain already posted
+    QElapsedTimer clock;                // thread safe to read
+    unsigned current, credit;
+    QTimer *reporter;
+    quint64 reported;
+
+    bool push(Queue& queue, Task& task);
+    bool take(Queue& queue, Task& task);
+    bool ready();
+    bool next(std::function<void()>& task);
+    void account(unsigned priority, qint64 queued);
+    void reporting();
+    bool event(QEvent *evt) final;
+
+private slots:
+    void drain();
+    void report();
+};
+
+/*!
+ * Priority queues in front of a thread.
+ * \file scheduler.hpp
+ */
+
+/*!
+ * \class Scheduler
+ * \brief Weighted priority queues for the requests of a thread.
+ * Signals routed thru a scheduler are queued by their priority class, from
+ * whatever thread emits them, rather than in the single first in first out
+ * event queue of the receiving thread.  The receiving thread drains them
+ * in weighted round robin, by default four registrations, then two
+ * messaging requests, then one control request, so that a burst of rosters
+ * and profiles from clients reconnecting does not hold back registration
+ * refreshes, while no class is ever starved.  Each class keeps it's own
+ * order.  Drains are done in short batches so that timers and other events
+ * of the thread are not held behind a long queue.
+ *
+ * Each class is queued in a bounded lock-free ring, so that posting from
+ * context threads takes no lock and allocates no Qt event, and the drain
+ * is only invoked when the receiving thread is not already draining.
+ * Should a ring fill, tasks are instead queued under a lock, and a class
+ * keeps using the lock until that queue is empty, so it stays in order.
+ * When rings are disabled in the [scheduler] config, each task is instead
+ * posted to the receiving thread as it's own Qt event, as a queued signal
+ * would be, and runs in the order of the thread's event queue without
+ * priority.  Queue depth statistics for each class, including how many
+ * tasks fell back, and the average nsecs spent posting a task and that it
+ * waited to run, are reported periodically, so the two paths may be
+ * compared under a registration storm, such as from sipp.  The depth of
+ * each queue, and how long it's last task waited, may be read by any
+ * thread without a lock, such as to shed new requests under Overload.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn Scheduler::route(Sender *sender, void (Sender::*signal)(Signal...), Receiver *receiver, void (Receiver::*slot)(Slot...), Class priority)
+ * \param sender Object emitting the signal, from any thread.
+ * \param signal Signal to route.
+ * \param receiver Object in the scheduler's thread.
+ * \param slot Slot of receiver to call with the signal's arguments.
+ * \param priority Class to queue the signal in.
+ */
+
+#endif
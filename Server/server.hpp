@@ -104,6 +104,10 @@ public:
         return Env;
     }
 
+    inline static const QVariant config(const QString& key) {
+        return CurrentConfig[key];
+    }
+
     static bool shutdown(int exitcode);
     static void reload();
     static void suspend();
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timerwheel.hpp"
+
+TimerWheel::Timer::Timer() :
+next(nullptr), link(nullptr), wheel(nullptr), deadline(0)
+{
+}
+
+TimerWheel::Timer::~Timer()
+{
+    if(wheel)
+        wheel->cancel(this);
+}
+
+TimerWheel::TimerWheel(qint64 resolution) :
+tick(resolution), current(0), active(0)
+{
+    Q_ASSERT(tick > 0);
+    memset(slots, 0, sizeof(slots));
+    clock.start();
+}
+
+TimerWheel::~TimerWheel()
+{
+    for(unsigned level = 0; level < LEVELS; ++level) {
+        for(unsigned slot = 0; slot < SLOTS; ++slot) {
+            auto timer = slots[level][slot];
+            while(timer) {
+                auto next = timer->next;
+                timer->next = nullptr;
+                timer->link = nullptr;
+                timer->wheel = nullptr;
+                timer = next;
+            }
+        }
+    }
+}
+
+// deadlines are rounded up to a whole tick, so a timer never fires early
+void TimerWheel::schedule(Timer *timer, qint64 msecs)
+{
+    Q_ASSERT(timer != nullptr);
+    if(timer->wheel)
+        timer->wheel->cancel(timer);
+
+    if(msecs < 0)
+        msecs = 0;
+
+    timer->deadline = (msecs + tick - 1) / tick;
+    if(timer->deadline <= current)
+        timer->deadline = current + 1;
+    timer->wheel = this;
+    ++active;
+    insert(timer);
+}
+
+void TimerWheel::cancel(Timer *timer)
+{
+    Q_ASSERT(timer != nullptr);
+    if(timer->wheel != this)
+        return;
+
+    remove(timer);
+    timer->wheel = nullptr;
+    --active;
+}
+
+unsigned TimerWheel::advance()
+{
+    auto now = clock.elapsed() / tick;
+    unsigned fired = 0;
+
+    while(current < now) {
+        ++current;
+        auto slot = static_cast<unsigned>(current) & MASK;
+        if(slot == 0)
+            cascade(1);
+
+        // unlink each before it fires, as expired() may re-schedule or
+        // delete itself or other timers still in this slot...
+        Timer *timer;
+        while((timer = slots[0][slot]) != nullptr) {
+            remove(timer);
+            timer->wheel = nullptr;
+            --active;
+            ++fired;
+            timer->expired();
+        }
+    }
+    return fired;
+}
+
+void TimerWheel::insert(Timer *timer)
+{
+    auto deadline = timer->deadline;
+    auto delta = deadline - current;
+    unsigned level = 0;
+    while(level < LEVELS - 1 && delta >= (qint64(1) << ((level + 1) * BITS)))
+        ++level;
+
+    // beyond the top level, park in its furthest slot until cascaded
+    auto limit = current + (qint64(1) << (LEVELS * BITS)) - 1;
+    if(deadline > limit)
+        deadline = limit;
+
+    auto slot = static_cast<unsigned>(deadline >> (level * BITS)) & MASK;
+    auto& head = slots[level][slot];
+    timer->next = head;
+    timer->link = &head;
+    if(head)
+        head->link = &timer->next;
+    head = timer;
+}
+
+void TimerWheel::remove(Timer *timer)
+{
+    *timer->link = timer->next;
+    if(timer->next)
+        timer->next->link = timer->link;
+    timer->next = nullptr;
+    timer->link = nullptr;
+}
+
+// move one higher level slot down as the level beneath it wraps
+void TimerWheel::cascade(unsigned level)
+{
+    if(level >= LEVELS)
+        return;
+
+    auto slot = static_cast<unsigned>(current >> (level * BITS)) & MASK;
+    if(slot == 0)
+        cascade(level + 1);
+
+    auto timer = slots[level][slot];
+    slots[level][slot] = nullptr;
+    while(timer) {
+        auto next = timer->next;
+        insert(timer);
+        timer = next;
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2017-2018 Tycho Softworks.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMERWHEEL_HPP_
+#define TIMERWHEEL_HPP_
+
+#include "../Common/compiler.hpp"
+
+#include <QElapsedTimer>
+
+class TimerWheel final
+{
+    Q_DISABLE_COPY(TimerWheel)
+
+public:
+    class Timer
+    {
+        friend class TimerWheel;
+        Q_DISABLE_COPY(Timer)
+
+    public:
+        inline bool isScheduled() const {
+            return wheel != nullptr;
+        }
+
+    protected:
+        Timer();
+        virtual ~Timer();
+
+        virtual void expired() = 0;
+
+    private:
+        Timer *next, **link;            // intrusive slot list
+        TimerWheel *wheel;
+        qint64 deadline;                // in wheel ticks
+    };
+
+    explicit TimerWheel(qint64 resolution = 1000l);
+    ~TimerWheel();
+
+    inline qint64 elapsed() const {
+        return clock.elapsed();
+    }
+
+    inline unsigned count() const {
+        return active;
+    }
+
+    void schedule(Timer *timer, qint64 msecs);
+    void cancel(Timer *timer);
+    unsigned advance();
+
+private:
+    enum : unsigned {
+        LEVELS = 4,
+        BITS = 6,
+        SLOTS = 1 << BITS,
+        MASK = SLOTS - 1,
+    };
+
+    QElapsedTimer clock;
+    qint64 tick, current;
+    unsigned active;
+    Timer *slots[LEVELS][SLOTS];
+
+    void insert(Timer *timer);
+    void remove(Timer *timer);
+    void cascade(unsigned level);
+};
+
+/*!
+ * Hierarchical timer wheel for objects that expire.
+ * \file timerwheel.hpp
+ */
+
+/*!
+ * \class TimerWheel
+ * \brief A hierarchical timer wheel.
+ * Timers are kept on intrusive lists in four levels of 64 slots, each level
+ * covering 64 times the span of the one below it.  Scheduling and canceling
+ * are constant time, and advancing the wheel visits only the slot that is
+ * due, plus an occasional cascade of one higher level slot down into the
+ * levels beneath it.  Deadlines further out than the top level are held
+ * in its furthest slot and re-cascaded until due.  The wheel is not thread
+ * safe and is meant to be advanced from the thread that owns its timers.
+ * \author David Sugar <tychosoft@gmail.com>
+ *
+ * \fn TimerWheel::schedule(Timer *timer, qint64 msecs)
+ * \param timer Object to schedule, moved if already scheduled.
+ * \param msecs Deadline in milliseconds on the wheel's elapsed() clock.
+ *
+ * \fn TimerWheel::advance()
+ * Fires every timer whose deadline has passed.  A timer is unlinked before
+ * it's expired() is called, so it may re-schedule or delete itself.
+ * \return number of timers fired.
+ */
+
+/*!
+ * \class TimerWheel::Timer
+ * \brief An object that may be scheduled on a timer wheel.
+ * Destroying a timer cancels it.
+ * \author David Sugar <tychosoft@gmail.com>
+ */
+
+#endif
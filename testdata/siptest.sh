@@ -6,6 +6,14 @@ case "$test" in
 ping)
 	exec sipp 127.0.0.1:4060 -sf ping.xml -p 4050 -m 5 -s 30
 	;;
+options|register|message)
+	# response times are written to ${scenario}_<pid>_rtt.csv for any
+	# server build, so older trees can be compared too.  Servers built
+	# with -DEVENT_TIMING=ON also report per event cost when they exit.
+	scenario="$test"
+	test "$test" = "options" && scenario="ping"
+	exec sipp 127.0.0.1:4060 -sf $scenario.xml -p 4050 -m ${2:-10000} -r ${3:-500} -s 30 -trace_rtt -rtt_freq 1000
+	;;
 *)
 	echo "siptest: $1: unknown test" >&2
 	exit 1